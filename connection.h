@@ -0,0 +1,841 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "metrics.h"
+#include "reactor.h"
+#include "socket_tuning.h"
+#include "write_queue.h"
+
+// the two halves of a session: a socket nosey accepted and one it connected out, each with its
+// write queue, backpressure and (on linux) splice relay
+
+class connection;
+
+typedef std::function<void (const uint8_t*, int)> receive_callback;
+typedef std::function<void ()> connect_callback;
+typedef std::function<void ()> disconnect_callback;
+typedef std::function<bool ()> connect_failed_callback; // true when it found somewhere else to connect
+
+// a connection tells its owner what happened through a handler whose type it is compiled with, so the
+// call for every chunk read goes straight to the owner and can be inlined; a handler has
+//   void on_connect() - accepted, or the connect completed
+//   void on_receive(const uint8_t* data, int length)
+//   void on_disconnect()
+//   bool on_connect_failed() - client connections only, true when it found somewhere else to connect
+// this one calls std::functions, for owners that would rather set them at run time
+class function_handler
+{
+    connect_callback connect_;
+    receive_callback receive_;
+    disconnect_callback disconnect_;
+    connect_failed_callback connect_failed_;
+
+public:
+    function_handler(
+        connect_callback on_connect,
+        receive_callback on_recv,
+        disconnect_callback on_disconnect,
+        connect_failed_callback on_connect_failed = nullptr
+    ) :
+        connect_(on_connect),
+        receive_(on_recv),
+        disconnect_(on_disconnect),
+        connect_failed_(on_connect_failed)
+    {
+    }
+
+    void on_connect()
+    {
+        connect_();
+    }
+
+    void on_receive(const uint8_t* data, int length)
+    {
+        receive_(data, length);
+    }
+
+    void on_disconnect()
+    {
+        disconnect_();
+    }
+
+    bool on_connect_failed()
+    {
+        return connect_failed_ && connect_failed_();
+    }
+};
+
+// tuning shared by every connection, each program defines these (nosey from its command line)
+extern size_t read_buffer_size;
+extern size_t io_budget;
+extern size_t high_watermark;
+extern size_t low_watermark;
+
+// what one connection has carried, the forward latency is how long bytes sat in the
+// proxy between the read that brought them in and the write that took them out
+struct traffic_stats
+{
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t forwards;
+    uint64_t forward_ns;
+    uint64_t forward_max_ns;
+    uint64_t throttles; // times reading stopped because the peer had too much queued
+
+    void forwarded(io_clock::time_point since)
+    {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(io_clock::now() - since).count();
+        forwards++;
+        forward_ns += ns;
+        forward_max_ns = std::max(forward_max_ns, ns);
+    }
+};
+
+#ifdef __linux__
+// relay mode stands this in for the write queue, bytes go from one socket into the
+// pipe and from the pipe into the other socket without being copied through user space
+struct splice_pipe
+{
+    int read_end;
+    int write_end;
+    size_t pending;
+    io_clock::time_point since;
+
+    bool open()
+    {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+            return false;
+        read_end = fds[0];
+        write_end = fds[1];
+        pending = 0;
+        fcntl(write_end, F_SETPIPE_SZ, 1 << 18); // best effort, the default 64k works too
+        return true;
+    }
+
+    void close()
+    {
+        if (read_end >= 0)
+        {
+            ::close(read_end);
+            ::close(write_end);
+        }
+        read_end = write_end = -1;
+        pending = 0;
+    }
+};
+#endif
+
+// the socket side of either half, what becomes of the bytes it reads is up to the class above it
+class connection : public io_handler
+{
+protected:
+    reactor& reactor_;
+    write_queue write_queue_;
+    SOCKET connection_;
+    bool closing_; // flush the write queue, then close without a disconnect callback
+    int interest_;
+    traffic_stats stats_;
+    io_clock::time_point last_receive_;
+    io_clock::time_point queued_since_;
+    bool throttled_; // not reading, the peer's queue is over the high watermark
+    connection* held_; // the connection we throttled, released at the low watermark
+    live_traffic* live_; // the event loop's running totals, if it keeps them
+#ifdef __linux__
+    connection* relay_peer_;
+    splice_pipe inbound_; // relay mode: bytes the peer read, waiting for this socket
+    bool relay_stalled_; // relay mode: stopped reading until the peer drains its pipe
+#endif
+
+    void count_received(size_t n)
+    {
+        stats_.bytes_received += n;
+        if (live_ != nullptr)
+            live_add(live_->bytes_received, n);
+    }
+
+    void count_sent(size_t n)
+    {
+        stats_.bytes_sent += n;
+        if (live_ != nullptr)
+            live_add(live_->bytes_sent, n);
+    }
+
+    connection() = delete;
+    connection(const connection&) = delete;
+    connection(connection &&) = delete;
+    void operator=(const connection&) = delete;
+    void operator=(connection&&) = delete;
+
+    virtual int interest() const
+    {
+        int events = 0;
+        if (!closing_ && !throttled_ && !relay_stalled())
+            events |= io_readable;
+        if (!write_queue_.empty() || (inbound_pending() > 0))
+            events |= io_writable;
+        return events;
+    }
+
+    // a client connection still connecting can't take relayed bytes yet
+    virtual bool can_send() const
+    {
+        return connection_ != INVALID_SOCKET;
+    }
+
+    // the socket failed or the far end closed, unless we were closing it anyway
+    virtual void disconnected() = 0;
+
+#ifdef __linux__
+    bool relay_stalled() const
+    {
+        return relay_stalled_;
+    }
+
+    size_t inbound_pending() const
+    {
+        return inbound_.pending;
+    }
+
+    // relay mode receive, the socket is spliced into the peer's pipe and on to the peer
+    bool splice_receive()
+    {
+        last_receive_ = io_clock::now();
+        splice_pipe& out = relay_peer_->inbound_;
+        size_t budget = io_budget;
+        while (!closing_ && (connection_ != INVALID_SOCKET) && (out.read_end >= 0))
+        {
+            if (budget == 0)
+            {
+                reactor_.post(connection_, this, io_readable);
+                break;
+            }
+
+            ssize_t nr = splice(connection_, nullptr, out.write_end, nullptr, std::min(budget, (size_t) 1 << 18), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (nr > 0)
+            {
+                if (out.pending == 0)
+                    out.since = last_receive_;
+                out.pending += nr;
+                count_received(nr);
+                budget -= nr;
+
+                if (relay_peer_->can_send() && !relay_peer_->drain_inbound())
+                    break;
+            }
+            else if (nr == 0)
+            {
+                fail();
+                return false;
+            }
+            else if (errno != EAGAIN)
+            {
+                fail();
+                return false;
+            }
+            else
+            {
+                // either the socket is empty or the pipe is full, in case it's the pipe stop
+                // reading until the peer has drained it, it'll wake us when it has
+                relay_stalled_ = (out.pending > 0);
+                break;
+            }
+        }
+        relay_peer_->update_interest();
+        return connection_ != INVALID_SOCKET;
+    }
+
+    bool drain_inbound()
+    {
+        size_t drained = 0;
+        while (inbound_.pending > 0)
+        {
+            ssize_t ns = splice(inbound_.read_end, nullptr, connection_, nullptr, inbound_.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (ns > 0)
+            {
+                inbound_.pending -= ns;
+                count_sent(ns);
+                drained += ns;
+            }
+            else if ((ns < 0) && (errno == EAGAIN))
+            {
+                break;
+            }
+            else
+            {
+                fail();
+                return false;
+            }
+        }
+
+        if (drained > 0)
+        {
+            if (inbound_.pending == 0)
+                stats_.forwarded(inbound_.since);
+            if (relay_peer_->relay_stalled_)
+            {
+                relay_peer_->relay_stalled_ = false;
+                relay_peer_->update_interest();
+            }
+        }
+        return true;
+    }
+#else
+    bool relay_stalled() const
+    {
+        return false;
+    }
+
+    size_t inbound_pending() const
+    {
+        return 0;
+    }
+#endif
+
+    void update_interest()
+    {
+        if (connection_ == INVALID_SOCKET)
+            return;
+
+        int events = interest();
+        if (events != interest_)
+        {
+            interest_ = events;
+            reactor_.update(connection_, this, events);
+        }
+    }
+
+    void attach(SOCKET fd)
+    {
+        connection_ = fd;
+        interest_ = interest();
+        reactor_.add(connection_, this, interest_);
+    }
+
+    void release_held()
+    {
+        connection* source = held_;
+        held_ = nullptr;
+        source->throttled_ = false;
+        source->update_interest();
+    }
+
+    void fail()
+    {
+        bool closing = closing_;
+        cleanup();
+        if (!closing)
+            disconnected();
+    }
+
+    // read until the socket would block, an edge triggered reactor won't tell us again
+    template <class handler_type>
+    bool receive(handler_type& handler)
+    {
+#ifdef __linux__
+        if (relay_peer_ != nullptr)
+            return splice_receive();
+#endif
+
+        // callbacks consume what they're handed before returning, so one buffer per thread is enough
+        static thread_local std::vector<uint8_t> io_buffer;
+        io_buffer.resize(read_buffer_size);
+
+        size_t budget = io_budget;
+        last_receive_ = io_clock::now();
+        while (!closing_ && !throttled_ && (connection_ != INVALID_SOCKET))
+        {
+            int nr = recv(connection_, (char*)io_buffer.data(), (int) std::min(io_buffer.size(), budget), 0);
+            if (nr > 0)
+            {
+                count_received(nr);
+                handler.on_receive(io_buffer.data(), nr);
+
+                budget -= nr;
+                if (budget == 0)
+                {
+                    // more may be waiting, come back to it after everyone else has had a turn
+                    if (connection_ != INVALID_SOCKET)
+                        reactor_.post(connection_, this, io_readable);
+                    break;
+                }
+            }
+            else if (nr == 0)
+            {
+                //TODO: handle far end calling shutdown, graceful one way close
+                fail();
+                return false;
+            }
+#ifdef _WIN32
+            else if (WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+#endif
+            {
+                fail();
+                return false;
+            }
+            else
+            {
+                break;
+            }
+        }
+        return connection_ != INVALID_SOCKET;
+    }
+
+    // hand everything queued to the kernel, one vectored send per max_gather chunks
+    bool flush()
+    {
+        bool queued = !write_queue_.empty();
+        size_t budget = io_budget;
+        while (!write_queue_.empty())
+        {
+            if (budget == 0)
+            {
+                reactor_.post(connection_, this, io_writable);
+                break;
+            }
+
+#ifdef _WIN32
+            WSABUF buffers[write_queue::max_gather];
+            DWORD count = (DWORD) write_queue_.gather(buffers, write_queue::max_gather);
+            size_t offered = 0;
+            for (DWORD n = 0; n < count; n++)
+                offered += buffers[n].len;
+            DWORD sent = 0;
+            int ns = (WSASend(connection_, buffers, count, &sent, 0, nullptr, nullptr) == 0) ? (int) sent : -1;
+#else
+            iovec buffers[write_queue::max_gather];
+            msghdr message = {0};
+            message.msg_iov = buffers;
+            message.msg_iovlen = write_queue_.gather(buffers, write_queue::max_gather);
+            size_t offered = 0;
+            for (size_t n = 0; n < message.msg_iovlen; n++)
+                offered += buffers[n].iov_len;
+            ssize_t ns = sendmsg(connection_, &message, MSG_NOSIGNAL);
+#endif
+            if (ns > 0)
+            {
+                write_queue_.consume(ns);
+                count_sent(ns);
+                budget -= std::min(budget, (size_t) ns);
+                if ((held_ != nullptr) && (write_queue_.size() <= low_watermark))
+                    release_held();
+                if ((size_t) ns < offered)
+                    break; // the socket buffer is full, wait to hear it's writable
+            }
+#ifdef _WIN32
+            else if (WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+#endif
+            {
+                fail();
+                return false;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (queued && write_queue_.empty())
+            stats_.forwarded(queued_since_);
+
+#ifdef __linux__
+        if ((relay_peer_ != nullptr) && !drain_inbound())
+            return false;
+#endif
+
+        if (closing_ && write_queue_.empty() && (inbound_pending() == 0))
+        {
+            cleanup();
+            return false;
+        }
+        return true;
+    }
+
+    template <class handler_type>
+    void process_io(int events, handler_type& handler)
+    {
+        if (connection_ == INVALID_SOCKET)
+            return;
+
+        if ((events & io_readable) && !receive(handler))
+            return;
+
+        if ((events & (io_writable | io_hangup)) && !flush())
+            return;
+
+        update_interest();
+    }
+
+public:
+    explicit connection(reactor& r) :
+        reactor_(r),
+        closing_(false),
+        interest_(0),
+        stats_({0}),
+        throttled_(false),
+        held_(nullptr),
+        live_(nullptr)
+    {
+        connection_ = INVALID_SOCKET;
+#ifdef __linux__
+        relay_peer_ = nullptr;
+        inbound_.read_end = inbound_.write_end = -1;
+        inbound_.pending = 0;
+        relay_stalled_ = false;
+#endif
+    }
+
+
+    ~connection() 
+    {
+        cleanup();
+#ifdef __linux__
+        inbound_.close();
+#endif
+    }
+
+#ifdef __linux__
+    // zero copy mode, whatever arrives here goes to the peer through a pipe and
+    // is never handed to the receive callback
+    bool relay_to(connection* peer)
+    {
+        if (!inbound_.open())
+            return false;
+        relay_peer_ = peer;
+        return true;
+    }
+#endif
+
+    void count_into(live_traffic* live)
+    {
+        live_ = live;
+    }
+
+    const traffic_stats& stats() const
+    {
+        return stats_;
+    }
+
+    io_clock::time_point last_receive() const
+    {
+        return last_receive_;
+    }
+
+    sockaddr_in get_near_end()
+    {
+        socklen_t length = sizeof(sockaddr_in);
+        sockaddr_in near_end = {0};
+        getsockname(connection_, (sockaddr*) &near_end, &length);
+        return near_end;
+    }
+
+    sockaddr_in get_far_end()
+    {
+        socklen_t length = sizeof(sockaddr_in);
+        sockaddr_in far_end = {0};
+        getpeername(connection_, (sockaddr*) &far_end, &length);
+        return far_end;
+    }
+
+    bool is_open() const
+    {
+        return connection_ != INVALID_SOCKET;
+    }
+
+    void cleanup()
+    {
+        if (connection_ != INVALID_SOCKET)
+        {
+            reactor_.remove(connection_);
+            cleanup_socket(connection_);
+        }
+        connection_ = INVALID_SOCKET;
+        closing_ = false;
+        interest_ = 0;
+        throttled_ = false;
+        held_ = nullptr;
+        write_queue_.clear();
+#ifdef __linux__
+        inbound_.close();
+#endif
+    }
+
+    // received is when the bytes came in on the other side, for the forward latency
+    void send(const uint8_t* data, int length, io_clock::time_point received)
+    {
+        if (write_queue_.empty())
+            queued_since_ = received;
+        write_queue_.append(data, length);
+        if (live_ != nullptr)
+            live_max(live_->queued_max, write_queue_.size());
+        update_interest();
+    }
+
+    void send(const uint8_t* data, int length)
+    {
+        send(data, length, io_clock::now());
+    }
+
+    // backpressure, once more than the high watermark is queued here the source stops
+    // reading until we've drained down to the low watermark
+    void hold_back(connection* source)
+    {
+        if ((high_watermark == 0) || (write_queue_.size() <= high_watermark) || source->throttled_)
+            return;
+
+        source->throttled_ = true;
+        source->stats_.throttles++;
+        source->update_interest();
+        held_ = source;
+    }
+
+    void disconnect()
+    {
+        cleanup();
+    }
+
+    // the far side of the session has gone, deliver what we still hold for this side then close
+    void close_after_flush()
+    {
+        if (write_queue_.empty() && (inbound_pending() == 0))
+        {
+            cleanup();
+        }
+        else
+        {
+            closing_ = true;
+            update_interest();
+        }
+    }
+};
+
+template <class handler_type>
+class basic_server_connection :
+    public connection
+{
+protected:
+    handler_type handler_;
+
+    void disconnected() override
+    {
+        handler_.on_disconnect();
+    }
+
+public:
+    // the arguments construct the handler
+    template <class... handler_args>
+    basic_server_connection(reactor& r, handler_args&&... args) :
+        connection(r),
+        handler_(std::forward<handler_args>(args)...)
+    {
+    }
+
+    // fd is nonblocking already, as accept_socket hands it over
+    void accept(SOCKET fd)
+    {
+        tune_connection(fd, false);
+        attach(fd);
+
+        handler_.on_connect();
+    }
+
+    void on_io(int events) override
+    {
+        process_io(events, handler_);
+    }
+};
+
+typedef basic_server_connection<function_handler> server_connection;
+
+template <class handler_type>
+class basic_client_connection : public connection
+{
+    bool connecting_;
+    bool enabled_;
+    handler_type handler_;
+    sockaddr_in far_end_;
+    std::chrono::milliseconds connect_timeout_; // zero to wait as long as the system does
+    timer connect_timer_;
+
+    void open(const sockaddr_in& far_end)
+    {
+        enabled_ = true;
+        connecting_ = true;
+        far_end_ = far_end;
+
+        SOCKET fd = open_stream_socket();
+        if (fd == INVALID_SOCKET)
+        {
+            // out of descriptors, as good as refused: the owner may fail over, else the session closes
+            connect_failed();
+            return;
+        }
+        tune_connection(fd, true);
+        attach(fd);
+
+        // completion, or an immediate refusal, is picked up when the socket reports writable
+        ::connect(connection_, (sockaddr*) &far_end_, sizeof(sockaddr_in));
+        reactor_.post(connection_, this, io_writable);
+        if (connect_timeout_.count() > 0)
+            connect_timer_.arm(reactor_.timers(), connect_timeout_);
+    }
+
+    // refused, unreachable or timed out: the owner may know somewhere else to go, else give up on the session
+    void connect_failed()
+    {
+        connecting_ = false;
+        connect_timer_.cancel();
+        if (handler_.on_connect_failed())
+            return;
+        enabled_ = false;
+        fail();
+    }
+
+protected:
+    int interest() const override
+    {
+        if (connecting_)
+            return io_writable;
+        return connection::interest();
+    }
+
+    bool can_send() const override
+    {
+        return !connecting_ && (connection_ != INVALID_SOCKET);
+    }
+
+    void disconnected() override
+    {
+        handler_.on_disconnect();
+    }
+
+public:
+    // the arguments construct the handler
+    template <class... handler_args>
+    basic_client_connection(reactor& r, handler_args&&... args) :
+        connection(r),
+        connecting_(false),
+        enabled_ (false),
+        handler_(std::forward<handler_args>(args)...),
+        far_end_({0}),
+        connect_timeout_(0),
+        connect_timer_([this]()
+            {
+                if (connecting_)
+                    connect_failed();
+            })
+    {
+    }
+    
+    // how long a connect may take before it counts as failed, zero for no limit
+    void set_connect_timeout(std::chrono::milliseconds timeout)
+    {
+        connect_timeout_ = timeout;
+    }
+
+    void disconnect()
+    {
+        cleanup();
+        enabled_ = false;
+        connecting_ = false;
+        connect_timer_.cancel();
+    }
+
+    void connect(const sockaddr_in& far_end)
+    {
+        write_queue_.clear();
+        open(far_end);
+    }
+
+    // the connect failed, try another far end, keeping what's queued for it
+    void redirect(const sockaddr_in& far_end)
+    {
+        if (connection_ != INVALID_SOCKET)
+        {
+            reactor_.remove(connection_);
+            cleanup_socket(connection_);
+            connection_ = INVALID_SOCKET;
+        }
+        interest_ = 0;
+        open(far_end);
+    }
+
+    // take over a socket that is already connected to far_end, as if connect had just completed
+    void adopt(SOCKET fd, const sockaddr_in& far_end)
+    {
+        enabled_ = true;
+        connecting_ = false;
+        far_end_ = far_end;
+        write_queue_.clear();
+        connect_timer_.cancel();
+
+        attach(fd);
+        handler_.on_connect();
+        reactor_.post(connection_, this, io_readable | io_writable);
+    }
+
+    void close_after_flush()
+    {
+        connection::close_after_flush();
+        if (connection_ == INVALID_SOCKET)
+            disconnect();
+    }
+
+    bool is_active() const
+    {
+        return enabled_;
+    }
+
+    void on_io(int events) override
+    {
+        if (!enabled_ || (connection_ == INVALID_SOCKET))
+            return;
+
+        if (connecting_)
+        {
+            if (!(events & (io_writable | io_hangup)))
+                return;
+
+            int r = ::connect(connection_, (sockaddr*) &far_end_, sizeof(sockaddr_in));
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEISCONN)
+#else
+            if ((r == 0) || (errno == EISCONN))
+#endif
+            {
+                connecting_ = false;
+                connect_timer_.cancel();
+                handler_.on_connect();
+                events |= io_writable;
+            }
+#ifdef _WIN32
+            else if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+            else if ((errno == EAGAIN) || (errno == EALREADY) || (errno == EINPROGRESS) || (errno == EWOULDBLOCK))
+#endif
+            {
+                return;
+            }
+            else
+            {
+                connect_failed();
+                return;
+            }
+        }
+
+        process_io(events, handler_);
+        if (connection_ == INVALID_SOCKET)
+            enabled_ = false; // closed or flushed, don't reconnect
+    }
+};
+
+typedef basic_client_connection<function_handler> client_connection;
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include <cstring>
+#endif
+#endif
+
+// host names looked up away from the event loops: a few resolver threads keep every name's address
+// fresh, and the loops only ever read the last answer, so a connect never waits on dns
+// getaddrinfo gives the address, so nsswitch and the rest of the system's configuration apply; on
+// linux a dns answer that has that address says, by its TTL, when to look again, capped at max_ttl,
+// which is also the lifetime of an answer without one (from the hosts file, say)
+// a failed lookup is tried again after retry, keeping the last good address meanwhile
+
+class dns_cache
+{
+public:
+    // one host name, every backend with that name shares it
+    struct entry
+    {
+        std::string host;
+        std::atomic<uint32_t> ip; // network order, 0 until a lookup has succeeded
+        std::atomic<uint64_t> lookups;
+        std::atomic<uint64_t> failures;
+        std::chrono::steady_clock::time_point refresh_at; // under the cache's mutex
+        bool in_flight;
+
+        explicit entry(const std::string& name) :
+            host(name),
+            ip(0),
+            lookups(0),
+            failures(0),
+            refresh_at(), // due as soon as the cache starts
+            in_flight(false)
+        {
+        }
+    };
+
+private:
+    std::vector<std::unique_ptr<entry>> entries_;
+    std::chrono::seconds max_ttl_;
+    std::chrono::seconds retry_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable answered_; // as each name has its first lookup done
+    size_t first_lookups_;
+    bool stopping_;
+
+    dns_cache(const dns_cache&) = delete;
+    void operator=(const dns_cache&) = delete;
+
+    // the system's own lookup, the hosts file, dns and any other name service in the order it has them
+    static bool system_address(const std::string& host, uint32_t& ip)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if ((getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0) || (found == nullptr))
+            return false;
+        ip = ((const sockaddr_in*) found->ai_addr)->sin_addr.s_addr;
+        freeaddrinfo(found);
+        return true;
+    }
+
+    // the smallest TTL on the name's A records, when the dns answer has ip among them; 0 otherwise,
+    // as the address came from somewhere else and the TTL wouldn't be its own
+    static uint32_t record_ttl(const std::string& host, uint32_t ip)
+    {
+        uint32_t ttl = 0;
+#ifdef __linux__
+        unsigned char answer[4096];
+        int length = res_search(host.c_str(), ns_c_in, ns_t_a, answer, sizeof(answer));
+        ns_msg message;
+        if ((length <= 0) || (ns_initparse(answer, length, &message) != 0))
+            return 0;
+
+        bool has_any = false;
+        bool has_ip = false;
+        for (int n = 0; n < ns_msg_count(message, ns_s_an); n++)
+        {
+            ns_rr record;
+            if ((ns_parserr(&message, ns_s_an, n, &record) != 0) || (ns_rr_type(record) != ns_t_a) || (ns_rr_rdlen(record) != 4))
+                continue;
+            ttl = has_any ? std::min(ttl, (uint32_t) ns_rr_ttl(record)) : ns_rr_ttl(record);
+            has_any = true;
+            has_ip = has_ip || (memcmp(ns_rr_rdata(record), &ip, 4) == 0);
+        }
+        if (!has_ip)
+            return 0;
+        ttl = std::max(ttl, (uint32_t) 1); // a zero TTL is as short as it gets, not none
+#endif
+        return ttl;
+    }
+
+    // blocks for as long as the lookup takes, returns how long the answer is good for
+    std::chrono::seconds lookup(entry& e)
+    {
+        uint32_t ip = 0;
+        e.lookups++;
+        if (!system_address(e.host, ip))
+        {
+            e.failures++;
+            return retry_;
+        }
+
+        e.ip = ip;
+        uint32_t ttl = record_ttl(e.host, ip);
+        if (ttl == 0)
+            return max_ttl_;
+        return std::min(std::chrono::seconds(ttl), max_ttl_);
+    }
+
+    // each thread takes whichever name is due next, so one slow name doesn't hold up the rest
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_)
+        {
+            auto now = std::chrono::steady_clock::now();
+            entry* due = nullptr;
+            auto next = std::chrono::steady_clock::time_point::max();
+            for (auto& e : entries_)
+            {
+                if (e->in_flight)
+                    continue;
+                if (e->refresh_at <= now)
+                {
+                    due = e.get();
+                    break;
+                }
+                next = std::min(next, e->refresh_at);
+            }
+
+            if (due == nullptr)
+            {
+                if (next == std::chrono::steady_clock::time_point::max())
+                    wake_.wait(lock);
+                else
+                    wake_.wait_until(lock, next);
+                continue;
+            }
+
+            bool first = (due->lookups == 0);
+            due->in_flight = true;
+            lock.unlock();
+            auto good_for = lookup(*due);
+            lock.lock();
+            due->in_flight = false;
+            due->refresh_at = std::chrono::steady_clock::now() + good_for;
+            if (first && (++first_lookups_ == entries_.size()))
+                answered_.notify_all();
+        }
+    }
+
+public:
+    dns_cache() :
+        max_ttl_(30),
+        retry_(5),
+        first_lookups_(0),
+        stopping_(false)
+    {
+    }
+
+    ~dns_cache()
+    {
+        stop();
+    }
+
+    // the entry for host, added before start
+    entry* add(const std::string& host)
+    {
+        for (auto& e : entries_)
+        {
+            if (e->host == host)
+                return e.get();
+        }
+        entries_.emplace_back(new entry(host));
+        return entries_.back().get();
+    }
+
+    size_t size() const
+    {
+        return entries_.size();
+    }
+
+    const entry& at(size_t n) const
+    {
+        return *entries_[n];
+    }
+
+    // keeps every name fresh on up to max_threads threads of their own, returning once each has
+    // been looked up, so a slow name only holds up startup by as long as it takes itself;
+    // false when some name didn't resolve
+    bool start(std::chrono::seconds max_ttl, std::chrono::seconds retry, size_t max_threads)
+    {
+        max_ttl_ = std::max(max_ttl, std::chrono::seconds(1));
+        retry_ = std::max(retry, std::chrono::seconds(1));
+        size_t threads = std::min(entries_.size(), max_threads);
+        for (size_t n = 0; n < threads; n++)
+            threads_.emplace_back([this]() { run(); });
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        answered_.wait(lock, [this]() { return first_lookups_ == entries_.size(); });
+        bool resolved = true;
+        for (auto& e : entries_)
+            resolved = resolved && (e->ip != 0);
+        return resolved;
+    }
+
+    // waits for lookups in progress to finish
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& t : threads_)
+            t.join();
+        threads_.clear();
+    }
+};
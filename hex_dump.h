@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define HEX_DUMP_SSE2
+#endif
+
+#if defined(HEX_DUMP_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HEX_DUMP_AVX2
+#endif
+
+// the hex dump nosey logs, built a whole line at a time in one buffer
+// every byte is turned into two hex digits and one display character up front, in bulk
+// (16 or 32 bytes per step where the CPU allows), then lines are assembled by copying runs
+
+enum hex_kernel
+{
+    hex_kernel_scalar,
+    hex_kernel_sse2,
+    hex_kernel_avx2,
+    hex_kernel_best
+};
+
+struct hex_tables
+{
+    char digits[256][2];
+    char text[256];
+
+    hex_tables()
+    {
+        const char* hex = "0123456789abcdef";
+        for (int n = 0; n < 256; n++)
+        {
+            digits[n][0] = hex[n >> 4];
+            digits[n][1] = hex[n & 0xf];
+            // what log_data always printed: 0x20 to 0x7f as is, anything else as a dot
+            text[n] = ((n >= 0x20) && (n < 0x80)) ? (char) n : '.';
+        }
+    }
+};
+
+inline const hex_tables& hex_table()
+{
+    static const hex_tables table;
+    return table;
+}
+
+inline void hex_encode_scalar(const uint8_t* data, size_t length, char* out)
+{
+    const hex_tables& table = hex_table();
+    for (size_t n = 0; n < length; n++)
+        memcpy(out + 2 * n, table.digits[data[n]], 2);
+}
+
+inline void hex_text_scalar(const uint8_t* data, size_t length, char* out)
+{
+    const hex_tables& table = hex_table();
+    for (size_t n = 0; n < length; n++)
+        out[n] = table.text[data[n]];
+}
+
+#ifdef HEX_DUMP_SSE2
+inline __m128i hex_digits_sse2(__m128i nibbles)
+{
+    // '0' + n, plus the distance from ':' to 'a' for n > 9
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+inline void hex_encode_sse2(const uint8_t* data, size_t length, char* out)
+{
+    const __m128i low_nibble = _mm_set1_epi8(0x0f);
+    size_t n = 0;
+    for (; n + 16 <= length; n += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (data + n));
+        __m128i high = hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble));
+        __m128i low = hex_digits_sse2(_mm_and_si128(bytes, low_nibble));
+        _mm_storeu_si128((__m128i*) (out + 2 * n), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i*) (out + 2 * n + 16), _mm_unpackhi_epi8(high, low));
+    }
+    hex_encode_scalar(data + n, length - n, out + 2 * n);
+}
+
+inline void hex_text_sse2(const uint8_t* data, size_t length, char* out)
+{
+    // 0x20 to 0x7f are exactly the bytes that are at least 0x20 when compared signed
+    const __m128i space = _mm_set1_epi8(0x1f);
+    const __m128i dots = _mm_set1_epi8('.');
+    size_t n = 0;
+    for (; n + 16 <= length; n += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (data + n));
+        __m128i printable = _mm_cmpgt_epi8(bytes, space);
+        __m128i text = _mm_or_si128(_mm_and_si128(printable, bytes), _mm_andnot_si128(printable, dots));
+        _mm_storeu_si128((__m128i*) (out + n), text);
+    }
+    hex_text_scalar(data + n, length - n, out + n);
+}
+#endif
+
+#ifdef HEX_DUMP_AVX2
+__attribute__((target("avx2")))
+inline __m256i hex_digits_avx2(__m256i nibbles)
+{
+    __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+__attribute__((target("avx2")))
+inline void hex_encode_avx2(const uint8_t* data, size_t length, char* out)
+{
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    size_t n = 0;
+    for (; n + 32 <= length; n += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (data + n));
+        __m256i high = hex_digits_avx2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibble));
+        __m256i low = hex_digits_avx2(_mm256_and_si256(bytes, low_nibble));
+        // unpack works inside each 128 bit lane: first holds bytes 0-7 and 16-23, second 8-15 and 24-31
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256((__m256i*) (out + 2 * n), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i*) (out + 2 * n + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    hex_encode_sse2(data + n, length - n, out + 2 * n);
+}
+
+__attribute__((target("avx2")))
+inline void hex_text_avx2(const uint8_t* data, size_t length, char* out)
+{
+    const __m256i space = _mm256_set1_epi8(0x1f);
+    const __m256i dots = _mm256_set1_epi8('.');
+    size_t n = 0;
+    for (; n + 32 <= length; n += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (data + n));
+        __m256i printable = _mm256_cmpgt_epi8(bytes, space);
+        _mm256_storeu_si256((__m256i*) (out + n), _mm256_blendv_epi8(dots, bytes, printable));
+    }
+    hex_text_sse2(data + n, length - n, out + n);
+}
+
+inline bool hex_has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// the kernel that will actually run when asked for one, falling back to what this build and CPU have
+inline int hex_resolve_kernel(int kernel)
+{
+#ifdef HEX_DUMP_AVX2
+    if (((kernel == hex_kernel_avx2) || (kernel == hex_kernel_best)) && hex_has_avx2())
+        return hex_kernel_avx2;
+#endif
+#ifdef HEX_DUMP_SSE2
+    if (kernel != hex_kernel_scalar)
+        return hex_kernel_sse2;
+#endif
+    return hex_kernel_scalar;
+}
+
+class hex_dumper
+{
+    typedef void (*kernel_function)(const uint8_t* data, size_t length, char* out);
+
+    // runs are copied in whole blocks, so every buffer read or written has this much to spare
+    static const size_t block = 16;
+
+    kernel_function encode_;
+    kernel_function text_;
+    std::vector<char> prefix_;
+    std::vector<char> digits_;
+    std::vector<char> chars_;
+
+    // fixed size copies compile to a couple of moves, where a call per short run costs more than the run
+    static char* copy_blocks(char* to, const char* from, size_t length)
+    {
+        for (size_t n = 0; n < length; n += block)
+            memcpy(to + n, from + n, block);
+        return to + length;
+    }
+
+    static char* fill_blocks(char* to, char c, size_t length)
+    {
+        for (size_t n = 0; n < length; n += block)
+            memset(to + n, c, block);
+        return to + length;
+    }
+
+    hex_dumper(const hex_dumper&) = delete;
+    void operator=(const hex_dumper&) = delete;
+
+public:
+    explicit hex_dumper(int kernel = hex_kernel_best) :
+        encode_(hex_encode_scalar),
+        text_(hex_text_scalar)
+    {
+        switch (hex_resolve_kernel(kernel))
+        {
+#ifdef HEX_DUMP_AVX2
+        case hex_kernel_avx2:
+            encode_ = hex_encode_avx2;
+            text_ = hex_text_avx2;
+            break;
+#endif
+#ifdef HEX_DUMP_SSE2
+        case hex_kernel_sse2:
+            encode_ = hex_encode_sse2;
+            text_ = hex_text_sse2;
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+
+    // appends the dump of data to out, each line starting with the prefix then repeats groups of
+    // " <word_width bytes in hex> <the same bytes as text>", a short last group padded in the hex only
+    void format(
+        std::string& out,
+        const char* prefix,
+        size_t prefix_length,
+        int word_width,
+        int repeats,
+        const uint8_t* data,
+        size_t length)
+    {
+        if ((word_width <= 0) || (repeats <= 0) || (length == 0))
+            return;
+
+        prefix_.resize(prefix_length + block);
+        memcpy(prefix_.data(), prefix, prefix_length);
+        digits_.resize(length * 2 + block);
+        chars_.resize(length + block);
+        encode_(data, length, digits_.data());
+        text_(data, length, chars_.data());
+
+        size_t width = word_width;
+        size_t line = width * repeats;
+        size_t lines = (length + line - 1) / line;
+        size_t begin = out.size();
+        out.resize(begin + lines * (prefix_length + repeats * (3 * width + 2) + 1) + block);
+
+        char* p = &out[begin];
+        for (size_t line_offs = 0; line_offs < length; line_offs += line)
+        {
+            p = copy_blocks(p, prefix_.data(), prefix_length);
+
+            for (size_t repeat_offs = line_offs; (repeat_offs < line_offs + line) && (repeat_offs < length); repeat_offs += width)
+            {
+                size_t n = std::min(width, length - repeat_offs);
+                *p++ = ' ';
+                p = copy_blocks(p, digits_.data() + 2 * repeat_offs, 2 * n);
+                if (n < width)
+                    p = fill_blocks(p, ' ', 2 * (width - n));
+                *p++ = ' ';
+                p = copy_blocks(p, chars_.data() + repeat_offs, n);
+            }
+            *p++ = '\n';
+        }
+        out.resize(p - out.data());
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <string>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+// the pieces of a hex dump line's prefix, shared by nosey and the tools that read its segment files
+
+// ip, port or ip:port, whichever of the two are asked for
+inline std::string endpoint_text(const sockaddr_in& addr, bool ip, bool port)
+{
+    std::string text;
+    if (ip)
+    {
+        char buffer[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, (void*) &addr.sin_addr, buffer, sizeof(buffer));
+        text += buffer;
+    }
+
+    if (ip && port)
+        text += ":";
+
+    if (port)
+        text += std::to_string(ntohs(addr.sin_port));
+
+    return text;
+}
+
+// the timestamp text changes once a second, so that's as often as it gets formatted
+class log_clock
+{
+    std::time_t second_;
+    std::string text_;
+
+public:
+    log_clock() :
+        second_(-1)
+    {
+    }
+
+    const std::string& format(std::chrono::system_clock::time_point time)
+    {
+        std::time_t second = std::chrono::system_clock::to_time_t(time);
+        if (second != second_)
+        {
+            char buffer[64];
+            size_t length = strftime(buffer, sizeof(buffer), "%F %T%z", std::localtime(&second));
+            text_.assign(buffer, length);
+            second_ = second;
+        }
+        return text_;
+    }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// bounded lock-free queue, any number of threads produce and one thread consumes
+// each cell carries a sequence number saying whose turn it is (after Dmitry Vyukov's
+// bounded MPMC queue), producers claim a cell, fill it in place, then publish it, so
+// records are never copied through the queue
+template <typename record>
+class log_queue
+{
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        record value;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_;
+    alignas(64) size_t dequeue_;
+
+    log_queue(const log_queue&) = delete;
+    void operator=(const log_queue&) = delete;
+
+public:
+    explicit log_queue(size_t capacity) :
+        enqueue_(0),
+        dequeue_(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+
+        cells_.reset(new cell[size]);
+        mask_ = size - 1;
+        for (size_t n = 0; n < size; n++)
+            cells_[n].sequence.store(n, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // producer side, returns nullptr when the queue is full
+    record* claim(size_t& ticket)
+    {
+        size_t pos = enqueue_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = cells_[pos & mask_];
+            size_t sequence = c.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+            if (diff == 0)
+            {
+                if (enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    ticket = pos;
+                    return &c.value;
+                }
+            }
+            else if (diff < 0)
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish(size_t ticket)
+    {
+        cells_[ticket & mask_].sequence.store(ticket + 1, std::memory_order_release);
+    }
+
+    // consumer side, nullptr when there's nothing published yet
+    record* front()
+    {
+        cell& c = cells_[dequeue_ & mask_];
+        size_t sequence = c.sequence.load(std::memory_order_acquire);
+        if (sequence != dequeue_ + 1)
+            return nullptr;
+        return &c.value;
+    }
+
+    void pop()
+    {
+        cells_[dequeue_ & mask_].sequence.store(dequeue_ + mask_ + 1, std::memory_order_release);
+        dequeue_++;
+    }
+};
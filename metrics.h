@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// counters an event loop keeps about itself while anything may read them
+// each is written by its loop's thread only, so an update is a plain load and store rather than
+// a locked read-modify-write, and a reader on another thread sees a recent value without tearing
+
+inline void live_add(std::atomic<uint64_t>& counter, uint64_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void live_max(std::atomic<uint64_t>& counter, uint64_t n)
+{
+    if (n > counter.load(std::memory_order_relaxed))
+        counter.store(n, std::memory_order_relaxed);
+}
+
+// everything the connections on one side of an event loop's sessions have carried
+struct live_traffic
+{
+    std::atomic<uint64_t> bytes_received;
+    std::atomic<uint64_t> bytes_sent;
+    std::atomic<uint64_t> queued_max; // the most one write queue has held
+
+    live_traffic() :
+        bytes_received(0),
+        bytes_sent(0),
+        queued_max(0)
+    {
+    }
+};
+
+// latencies in log-linear buckets, after HDR histograms: two buckets per power of two from 1us
+// to about a minute, so a bucket is at most 50% wide and recording is a count of leading zeros
+class latency_histogram
+{
+public:
+    static const int first_octave = 10; // 1024ns
+    static const int octaves = 26;
+    static const int buckets = 2 * octaves + 2; // the 1us bucket first, everything too slow last
+
+private:
+    std::atomic<uint64_t> counts_[buckets];
+    std::atomic<uint64_t> sum_ns_;
+
+    static int floor_log2(uint64_t v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#else
+        int log = 0;
+        while (v >>= 1)
+            log++;
+        return log;
+#endif
+    }
+
+public:
+    latency_histogram() :
+        sum_ns_(0)
+    {
+        for (auto& count : counts_)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket(uint64_t ns)
+    {
+        if (ns <= ((uint64_t) 1 << first_octave))
+            return 0;
+        uint64_t v = ns - 1;
+        int octave = floor_log2(v);
+        int n = 1 + 2 * (octave - first_octave) + (int) ((v >> (octave - 1)) & 1);
+        return (n < buckets - 1) ? n : buckets - 1;
+    }
+
+    // the largest latency bucket n holds, in seconds, the last has no bound
+    static double upper_bound(int n)
+    {
+        if (n == 0)
+            return ((uint64_t) 1 << first_octave) / 1e9;
+        int octave = first_octave + (n - 1) / 2;
+        double low = (double) ((uint64_t) 1 << octave);
+        return ((n & 1) ? low * 1.5 : low * 2) / 1e9;
+    }
+
+    void record(uint64_t ns)
+    {
+        live_add(counts_[bucket(ns)], 1);
+        live_add(sum_ns_, ns);
+    }
+
+    void record(std::chrono::nanoseconds elapsed)
+    {
+        record((uint64_t) std::max(elapsed.count(), (std::chrono::nanoseconds::rep) 0));
+    }
+
+    uint64_t count(int n) const
+    {
+        return counts_[n].load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum_ns() const
+    {
+        return sum_ns_.load(std::memory_order_relaxed);
+    }
+};
@@ -1,779 +1,2563 @@
-#include <iostream>
-#include <deque>
-#include <cstdint>
-#include <functional>
-#include <vector>
-#include <iomanip>
-#include <sstream>
-#include <ctime>
-#include <chrono>
-#include <memory>
-#include <algorithm>
-
-#ifdef _WIN32
-#include <WinSock2.h>
-#include <ws2tcpip.h>
-
-#pragma comment(lib, "Ws2_32.lib")
-typedef int socklen_t;
-#else
-#include <poll.h>
-#include <sys/socket.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
-#include <arpa/inet.h>
-#include <fcntl.h>
-#include <unistd.h>
-
-typedef int SOCKET;
-const SOCKET INVALID_SOCKET = -1;
-#endif
-
-class connection;
-
-typedef std::function<void (const uint8_t*, int)> receive_callback;
-typedef std::function<void ()> connect_callback;
-typedef std::function<void ()> disconnect_callback;
-
-short listen_port = 8080;
-std::string listen_address = "0.0.0.0";
-
-short connect_port = 80;
-std::string connect_address = "127.0.0.10";
-
-bool report_ip = false;
-bool report_port = false;
-bool report_time = false;
-int report_width = 8;
-int report_repeats = 3;
-bool verbose = false;
-
-void set_nonblocking(SOCKET fd)
-{
-    if (fd < 0) return;
-
-#ifdef _WIN32
-   unsigned long mode = 1;
-   ioctlsocket(fd, FIONBIO, &mode);
-#else
-   int flags = fcntl(fd, F_GETFL, 0);
-   if (flags == -1) return;
-
-   flags = (flags | O_NONBLOCK);
-   fcntl(fd, F_SETFL, flags);
-#endif
-}
-
-void cleanup_socket(SOCKET fd)
-{
-#ifdef _WIN32
-    closesocket(fd);
-#else
-    close(fd);
-#endif
-}
-
-class connection
-{
-protected:
-    std::deque<uint8_t> write_queue_; //TODO: circular buffer?
-    receive_callback on_recv_;
-    disconnect_callback on_disconnect_;
-    SOCKET connection_;
-
-    connection() = delete;
-    connection(const connection&) = delete;
-    connection(connection &&) = delete;
-    void operator=(const connection&) = delete;
-    void operator=(connection&&) = delete;
-
-public:
-    connection(
-        receive_callback on_recv,
-        disconnect_callback on_disconnect
-    ) :
-        on_recv_(on_recv),
-        on_disconnect_(on_disconnect)
-    {
-        connection_ = INVALID_SOCKET;
-    }
-
-
-    ~connection() 
-    {
-        if (connection_ != INVALID_SOCKET)
-        {
-            cleanup_socket(connection_);
-        }
-    }
-
-    sockaddr_in get_near_end()
-    {
-        socklen_t length = sizeof(sockaddr_in);
-        sockaddr_in near_end = {0};
-        getsockname(connection_, (sockaddr*) &near_end, &length);
-        return near_end;
-    }
-
-    sockaddr_in get_far_end()
-    {
-        socklen_t length = sizeof(sockaddr_in);
-        sockaddr_in far_end = {0};
-        getpeername(connection_, (sockaddr*) &far_end, &length);
-        return far_end;
-    }
-
-    void cleanup()
-    {
-        if (connection_ != INVALID_SOCKET)
-            cleanup_socket(connection_);
-        connection_ = INVALID_SOCKET;
-        write_queue_.clear();
-    }
-
-    void send(const uint8_t* data, int length)
-    {
-        for(int i = 0; i < length; i++)
-        {
-            write_queue_.push_back(data[i]);
-        }
-    }
-
-    void disconnect()
-    {
-        cleanup();
-    }
-
-    void prepare_for_poll(std::vector<pollfd>& events)
-    {
-        if (connection_ == INVALID_SOCKET)
-            return;
-
-        pollfd selector;
-        selector.fd = connection_;
-        selector.events = POLLIN | POLLERR | POLLHUP;
-#ifndef _WIN32
-        selector.events |= POLLRDHUP;
-#endif
-        selector.revents = 0;
-        
-        if (!write_queue_.empty())
-            selector.events |= POLLOUT;
-        
-        events.push_back(selector);
-    }
-
-    void poll()
-    {
-        if (connection_ == INVALID_SOCKET)
-            return;
-
-        //todo: receive always ready?
-        uint8_t io_buffer[256];
-        int nr = recv(connection_, (char*)io_buffer, sizeof(io_buffer), 0);
-        if (nr > 0)
-        {
-            on_recv_(io_buffer, nr);
-        }
-        else if (nr == 0)
-        {
-            //TODO: handle far end calling shutdown, graceful one way close
-            cleanup();
-            on_disconnect_();
-            return;
-        }
-#ifdef _WIN32
-        else if (WSAGetLastError() != WSAEWOULDBLOCK)
-#else
-        else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
-#endif
-        {
-            cleanup();
-            on_disconnect_();
-            return;
-        }
-
-        if (!write_queue_.empty()) {
-            int n = 0;
-            for (n = 0; n < write_queue_.size() && n < sizeof(io_buffer); n++)
-            {
-                io_buffer[n] = write_queue_[n];
-            }
-            int ns = ::send(connection_, (char*) io_buffer, n, 0);
-            if (ns > 0)
-            {
-                write_queue_.erase(
-                    write_queue_.begin(),
-                    write_queue_.begin() + ns);
-            }
-#ifdef _WIN32
-            else if (WSAGetLastError() != WSAEWOULDBLOCK)
-#else
-            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
-#endif
-            {
-                cleanup();
-                on_disconnect_();
-                return;
-            }
-        }
-    }
-};
-
-class server_connection :
-    public connection
-{
-protected:
-    connect_callback on_accept_;
-public:
-    server_connection (
-        connect_callback on_accept,
-        receive_callback on_recv,
-        disconnect_callback on_disconnect
-    ) :
-        connection(on_recv, on_disconnect),
-        on_accept_(on_accept)
-    {
-    }
-
-    void poll(SOCKET l)
-    {
-        if (connection_ == INVALID_SOCKET)
-        {
-            sockaddr_in far_end = {0};
-            socklen_t addr_len = sizeof(sockaddr_in);
-            connection_ = accept(l, (sockaddr*) &far_end, &addr_len);
-
-            if (connection_ != INVALID_SOCKET)
-            {
-                set_nonblocking(connection_);
-
-                on_accept_();
-            }
-        }
-
-        if (connection_ != INVALID_SOCKET)
-        {
-            connection::poll();
-        }
-    }
-};
-
-class client_connection : public connection
-{
-    bool connecting_;
-    bool enabled_;
-    connect_callback on_connect_;
-
-public:
-    client_connection(
-        connect_callback on_connect,
-        receive_callback on_recv,
-        disconnect_callback on_disconnect
-    ) :
-        connection(on_recv, on_disconnect),
-        connecting_(false),
-        enabled_ (false),
-        on_connect_(on_connect)
-    {
-    }
-    
-    void disconnect()
-    {
-        cleanup();
-        enabled_ = false;
-        connecting_ = false;
-    }
-
-    void connect()
-    {
-        enabled_ = true;
-        write_queue_.clear();
-    }
-
-    void prepare_for_poll(std::vector<pollfd>& events)
-    {
-        if (connection_ == INVALID_SOCKET)
-            return;
-
-        pollfd selector;
-        selector.fd = connection_;
-        selector.events = POLLIN | POLLERR | POLLHUP;
-#ifndef _WIN32
-        selector.events |= POLLRDHUP;
-#endif 
-        selector.revents = 0;
-        
-        if (!write_queue_.empty() || connecting_)
-            selector.events |= POLLOUT;
-        
-        events.push_back(selector);
-    }
-
-    void poll(const sockaddr_in& far_end)
-    {
-        if (enabled_)
-        {
-            if (connection_ == INVALID_SOCKET)
-            {
-                connecting_ = true;
-                connection_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-                set_nonblocking(connection_);
-            }
-
-            if (connecting_)
-            {
-                int r = ::connect(connection_, (sockaddr*) &far_end, sizeof(sockaddr_in));
-#ifdef _WIN32
-                if (WSAGetLastError() == WSAEISCONN)
-#else
-                if ((r == 0) || (errno == EISCONN))
-#endif
-                {
-                    connecting_ = false;
-                    on_connect_();
-                }
-#ifdef _WIN32
-                else if (WSAGetLastError() == WSAEWOULDBLOCK)
-#else
-                else if ((errno == EAGAIN) || (errno == EALREADY) || (errno == EINPROGRESS) || (errno == EWOULDBLOCK))
-#endif
-                {
-                    return;
-                }
-                else
-                {
-                    cleanup_socket(connection_);
-                    connection_ = INVALID_SOCKET;
-                }
-            }
-
-            if (!connecting_)
-            {
-                connection::poll();
-            }
-        }
-    }
-};
-
-std::string get_log_prefix(const sockaddr_in& addr, bool dir_in)
-{
-    std::stringstream ss;
-    if (report_time)
-    {
-        auto time = std::time(nullptr);
-        ss << std::put_time(std::localtime(&time), "%F %T%z");
-    }
-    ss << (dir_in ? ">" : "<");
-    if (report_ip)
-        ss << inet_ntoa(addr.sin_addr);
-
-    if (report_ip && report_port)
-        ss << ":";
-
-    if (report_port)
-        ss << std::dec << ntohs(addr.sin_port);
-
-    return ss.str();
-}
-
-void log_data(
-    const std::string& line_pref,
-    int word_width,
-    int repeats,
-    const uint8_t* data,
-    int length
-)
-{
-    int l = 0;
-    for(;;)
-    {
-        int line_offs = (l * word_width * repeats);
-        if (line_offs >= length)
-            break;
-
-        std::cout << line_pref;
-
-        for(int r = 0; r < repeats; r++)
-        {
-            int repeat_offs = line_offs + r * word_width;
-            if (repeat_offs >= length)
-                break;
-
-            std::cout << " ";
-
-            for (int n = 0; n < word_width; n ++)
-            {
-                int word_offs = repeat_offs + n;
-                if (word_offs >= length)
-                    std::cout << "  ";
-                else
-                    std::cout << std::hex << std::setw(2) << std::setfill('0') << (int) data[word_offs];
-            }
-
-            std::cout << " ";
-
-            for (int n = 0; n < word_width; n ++)
-            {
-                int word_offs = repeat_offs + n;
-                if (word_offs >= length)
-                    break;
-                char c = (char) data[word_offs];
-                if (c >= 0x20 && c < 0xFF) {
-                    std::cout << c;
-                }
-                else
-                {
-                    std::cout << ".";
-                }
-                
-            }
-        }
-        std::cout << std::endl;
-        l ++;
-    }
-}
-
-class connector
-{
-    sockaddr_in server_near_;
-    sockaddr_in server_far_;
-    sockaddr_in client_near_;
-    sockaddr_in client_far_;
-    std::shared_ptr<server_connection> server_;
-    std::shared_ptr<client_connection> client_;
-    SOCKET listener_;
-
-public:
-
-    void on_client_recv(const uint8_t* data, int length)
-    {
-        log_data(get_log_prefix(client_far_, false), report_width, report_repeats, data, length);
-        server_->send(data, length);
-    }
-
-    void on_client_connect()
-    {
-        client_near_ = client_->get_near_end();
-        client_far_ = client_->get_far_end();
-        std::cout << get_log_prefix(client_far_, true) << " connected successfully" << std::endl;
-    }
-
-    void on_client_disconnect()
-    {
-        client_->disconnect(); //to stop it from reconnecting
-        server_->disconnect();
-
-        std::cout << get_log_prefix(client_far_, false) << " disconnect" << std::endl;
-        std::cout << get_log_prefix(server_far_, false) << " disconnect" << std::endl;
-    }
-
-    void on_server_recv(const uint8_t* data, int length)
-    {
-        log_data(get_log_prefix(server_far_, true), report_width, report_repeats, data, length);
-        client_->send(data, length);
-    }
-
-    void on_server_accept()
-    {
-        server_near_ = server_->get_near_end();
-        server_far_ = server_->get_far_end();
-        std::cout << get_log_prefix(server_far_, true) << " accepted connection" << std::endl;
-        std::cout << get_log_prefix(client_far_, true) << " connecting ..." << std::endl;
-
-        client_->connect();
-    }
-
-    void on_server_disconnect()
-    {
-        std::cout << get_log_prefix(server_far_, true) << " disconnect" << std::endl;
-        std::cout << get_log_prefix(client_far_, true) << " disconnect" << std::endl;
-
-        server_->disconnect();
-        client_->disconnect();
-    }
-
-    connector() = delete;
-
-    connector(connector&& c) = delete;
-
-    connector(SOCKET listener, const sockaddr_in& connect_addr):
-        server_near_({0}),
-        server_far_({0}),
-        client_near_({0}),
-        client_far_({0}),
-        server_(std::make_shared<server_connection>(
-            [this]()
-            {
-                on_server_accept();
-            },
-            [this](const uint8_t* data, int length)
-            {
-                on_server_recv(data, length);
-            },
-            [this]()
-            {
-                on_server_disconnect();
-            })),
-        client_(std::make_shared<client_connection>(
-            [this]()
-            {
-                on_client_connect();
-            },
-            [this](const uint8_t* data, int length)
-            {
-                on_client_recv(data, length);
-            },
-            [this]()
-            {
-                on_client_disconnect();
-            })),
-        listener_(INVALID_SOCKET)
-    {
-        client_far_= connect_addr;
-        listener_ = listener;
-    }
-
-    void prepare_for_poll(std::vector<pollfd>& descriptors)
-    {
-        server_->prepare_for_poll(descriptors);
-        client_->prepare_for_poll(descriptors);
-    }
-
-    void poll()
-    {
-        server_->poll(listener_);
-        client_->poll(client_far_);
-    }
-};
-
-void run_listener(SOCKET fd, const sockaddr_in& connect_addr)
-{
-    std::vector<std::shared_ptr<connector>> connections;
-    connections.push_back(std::make_shared<connector>(fd, connect_addr));
-
-    std::vector<pollfd> descriptors;
-    for (;;)
-    {
-        descriptors.clear();
-        pollfd selector;
-        selector.fd = fd;
-        selector.events = POLLIN | POLLERR;
-        selector.revents = 0;
-        descriptors.push_back(selector);
-
-        for(auto& connection : connections)
-        {
-            connection->prepare_for_poll(descriptors);
-        }
-#ifdef _WIN32
-        WSAPoll(descriptors.data(), descriptors.size(), 1000);
-#else
-        poll(descriptors.data(), descriptors.size(), 1000);
-#endif
-        for(auto& connection : connections)
-        {
-            connection->poll();
-        }
-    }
-}
-
-bool parse_args(int argc, char** argv)
-{
-    bool help = false;
-
-    std::string argument_to_parse = "";
-    for(int a = 1; a < argc; a++)
-    {
-        std::string arg = argv[a];
-        if (argument_to_parse == "")
-        {
-            if ((arg == "-p") || (arg == "--listen-port"))
-            {
-                argument_to_parse = "listen-port";
-            }
-            else if ((arg == "-d") || (arg == "--destination-port"))
-            {
-                argument_to_parse = "destination-port";
-            }
-            else if ((arg == "-a") || (arg == "--destination-addr"))
-            {
-                argument_to_parse = "destination-addr";
-            }
-            else if ((arg == "-l") || (arg == "--listen-addr"))
-            {
-                argument_to_parse = "listen-addr";
-            }
-            else if ((arg == "-w") || (arg == "--report-width"))
-            {
-                argument_to_parse = "report-width";
-            }
-            else if ((arg == "-r") || (arg == "--report-repeats"))
-            {
-                argument_to_parse = "report-repeats";
-            }
-            else if ((arg == "-t") || (arg == "--report-time"))
-            {
-                report_time = true;
-            }
-            else if ((arg == "-i") || (arg == "--report-ip"))
-            {
-                report_ip = true;
-            }
-            else if ((arg == "-n") || (arg == "--report-port"))
-            {
-                report_port = true;
-            }
-            else if ((arg == "-v") || (arg == "--verbose"))
-            {
-                verbose = true;
-                report_ip = true;
-                report_port = true;
-                report_time = true;
-            }
-            else if ((arg == "-?") || (arg == "--help"))
-            {
-                help = true;
-            }
-            else
-            {
-                break;
-                help = true;
-            }
-        }
-        else
-        {
-            if (argument_to_parse == "listen-port")
-            {
-                listen_port = atoi(arg.c_str());
-            }
-            else if (argument_to_parse == "destination-port")
-            {
-                connect_port = atoi(arg.c_str());
-            }
-            else if (argument_to_parse == "destination-addr")
-            {
-                connect_address = arg; //todo: validation?
-            }
-            else if (argument_to_parse == "listen-addr")
-            {
-                listen_address = arg; //todo: validation?
-            }
-            else if (argument_to_parse == "report-width")
-            {
-                report_width = atoi(arg.c_str());
-            }
-            else if (argument_to_parse == "report-repeats")
-            {
-                report_repeats = atoi(arg.c_str());
-            }
-            else
-            {
-                help = true;
-                std::cerr << "internal error" << std::endl;
-            }
-            argument_to_parse = "";
-        }
-    }
-
-    if (argument_to_parse != "")
-    {
-        std::cerr << "expected argument for " << argument_to_parse << std::endl;
-    }
-
-    if (help)
-    {
-        std::cerr << "usage: " << std::endl;
-        std::cerr << "\tnosey [options]" << std::endl << std::endl;
-        std::cerr << "option listing:" << std::endl;
-        std::cerr << "\t-l/--listen-addr, " << listen_address << std::endl;
-        std::cerr << "\t-p/--listen-port, " << listen_port << std::endl;
-        std::cerr << "\t-a/--destination-addr, " << connect_address << std::endl;
-        std::cerr << "\t-d/--destination-port, " << connect_port << std::endl;
-        std::cerr << "\t-w/--report-width, " << report_width << std::endl;
-        std::cerr << "\t-r/--report-repeats, " << report_repeats << std::endl;
-        std::cerr << "\t-t/--report-time" << std::endl;
-        std::cerr << "\t-i/--report-ip" << std::endl;
-        std::cerr << "\t-n/--report-port" << std::endl;
-        std::cerr << "\t-v/--verbose" << std::endl;
-        std::cerr << "\t-?/--help" << std::endl;
-        std::cerr << std::endl;
-        return false;
-    }
-
-    return true;
-}
-
-int main(int argc, char** argv) 
-{
-    if (!parse_args(argc, argv))
-    {
-        return -1;
-    }
-
-#ifdef _WIN32
-    WORD wVersionRequested;
-    WSADATA wsaData;
-    wVersionRequested = MAKEWORD(2, 2);
-
-    int err = WSAStartup(wVersionRequested, &wsaData);
-    if (err != 0) {
-        printf("WSAStartup failed with error: %d\n", err);
-        return 1;
-    }
-#endif
-
-    sockaddr_in listen_addr = { 0 }, connect_addr = { 0 };
-    listen_addr.sin_family = AF_INET;
-    listen_addr.sin_port = htons(listen_port);
-    connect_addr.sin_family = AF_INET;
-    connect_addr.sin_port = htons(connect_port);
-
-#ifdef _WIN32
-    int r = InetPtonA(AF_INET, listen_address.c_str(), &listen_addr.sin_addr);
-#else
-    int r = inet_aton(listen_address.c_str(), &listen_addr.sin_addr);
-#endif
-
-    if (r == 0)
-        std::cerr << "invalid address: " << listen_address << std::endl;
-
-#ifdef _WIN32
-    r = InetPtonA(AF_INET, connect_address.c_str(), &connect_addr.sin_addr);
-#else
-    r = inet_aton(connect_address.c_str(), &connect_addr.sin_addr);
-#endif
-    if (r == 0)
-        std::cerr << "invalid address: " << connect_address << std::endl;
-
-    if (verbose)
-        std::cout << "configured far end: " << inet_ntoa(connect_addr.sin_addr) << ":" << ntohs(connect_addr.sin_port) << std::endl;
-
-    std::cout << get_log_prefix(listen_addr, true) << " listening" << std::endl;
-    SOCKET fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    set_nonblocking(fd);
-
-    r = bind(fd, (sockaddr*) &listen_addr, sizeof(sockaddr_in));
-    if (r == 0)
-    {
-        if(listen(fd, 10) == 0)
-        {
-            run_listener(fd, connect_addr);
-        }
-        else
-        {
-            std::cout << "failure to listen" << std::endl;
-        }
-    }
-    else
-    {
-        std::cerr << "could not bind to port" << std::endl;
-    }
-
-    cleanup_socket(fd);
-#ifdef _WIN32
-    WSACleanup();
-#endif
-    return 0;
+#include <iostream>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <ctime>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "connection.h"
+#include "dns_cache.h"
+#include "log_queue.h"
+#include "pool.h"
+#include "hex_dump.h"
+#include "log_format.h"
+#include "pcapng.h"
+#ifndef _WIN32
+#include "segment_log.h"
+#endif
+#include "stream_decoder.h"
+
+short listen_port = 8080;
+std::string listen_address = "0.0.0.0";
+
+short connect_port = 80; // for destinations given without a port
+std::string connect_address = "127.0.0.10";
+std::vector<std::string> connect_addresses; // every -a, host or host:port
+std::string balance_policy = "round-robin";
+
+bool report_ip = false;
+bool report_port = false;
+bool report_time = false;
+int report_width = 8;
+int report_repeats = 3;
+bool verbose = false;
+size_t max_sessions = 1024; // across all workers
+size_t pool_min_idle = 0; // upstream connections kept ready per worker, 0 turns the pool off
+size_t pool_max_idle = 64;
+int pool_idle_timeout = 30; // seconds
+int connect_timeout = 10; // seconds for an upstream connect, 0 for the system's own
+int idle_timeout = 0; // seconds a session may go without reading anything, 0 for no limit
+int session_lifetime = 0; // seconds a session may last, 0 for no limit
+std::atomic<size_t> active_sessions(0);
+std::atomic<uint64_t> session_count(0); // every session started, the latest one's number
+int worker_threads = 1;
+bool pin_workers = false;
+bool dump_data = true;
+bool use_splice = true;
+size_t read_buffer_size = 1 << 16;
+socket_tuning tcp_tuning = { false, false, 0, 0, 0, SOMAXCONN };
+std::string tcp_profile = "default"; // latency or throughput turn on a set of the options in tcp_tuning
+size_t io_budget = 1 << 20; // bytes a connection may move per readiness event before others get a turn
+size_t high_watermark = 1 << 20;
+size_t low_watermark = 1 << 18;
+size_t log_queue_size = 4096; // records, each holds up to log_payload_size bytes of received data
+const size_t event_queue_size = 256; // records, when only events are logged
+bool log_drop = false; // drop records when the log writer falls behind instead of stalling the relay
+std::string capture_file;
+std::string segment_file; // base name of rotating segment files, instead of a hex dump
+size_t segment_size = 64; // megabytes
+int segment_seconds = 0; // 0 to rotate by size only
+size_t segment_keep = 8;
+int metrics_port = 0; // on 127.0.0.1, 0 for no metrics endpoint
+int dns_ttl = 30; // seconds a looked up name is kept at most, and when its answer has no TTL
+int dns_retry = 5; // seconds before a failed lookup is tried again
+dns_cache host_names; // destinations given by name
+std::string frame_spec = "none"; // how the dump splits traffic into messages, see make_decoder
+std::string log_pattern; // only dump messages containing these bytes
+bool log_headers_only = false;
+size_t log_limit = 0; // bytes logged from each direction of a session, 0 for all of them
+size_t log_sample = 1; // log one session in this many
+size_t log_rate = 0; // bytes a second logged across all sessions, 0 for no cap
+volatile sig_atomic_t stop_requested = 0;
+#ifdef __linux__
+std::string reactor_backend = "epoll";
+#else
+std::string reactor_backend = "poll";
+#endif
+
+void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+// the ip:port part of a log prefix, whichever of the two the report options ask for
+// connectors work this out once per far end rather than once per line
+std::string log_endpoint(const sockaddr_in& addr)
+{
+    return endpoint_text(addr, report_ip, report_port);
+}
+
+const size_t log_payload_size = 4096;
+const size_t log_endpoint_size = 24; // "255.255.255.255:65535"
+
+enum log_kind
+{
+    log_kind_data,
+    log_kind_event,
+    log_kind_line,
+    log_kind_packet
+};
+
+// what the I/O path hands the writer thread, raw bytes and where they came from, not text
+struct log_record
+{
+    int kind;
+    bool dir_in;
+    std::chrono::system_clock::time_point time;
+    size_t endpoint_length;
+    char endpoint[log_endpoint_size];
+    sockaddr_in source; // packets only
+    sockaddr_in destination;
+    uint32_t seq;
+    uint32_t ack;
+    size_t length;
+    uint8_t payload[log_payload_size];
+};
+
+// formatting and writing happen on a thread of their own, so a slow terminal or disk
+// costs queue space rather than proxy throughput
+class log_writer
+{
+    std::unique_ptr<log_queue<log_record>> queue_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::atomic<bool> idle_;
+    std::atomic<uint64_t> dropped_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool block_;
+    pcapng_writer capture_;
+#ifndef _WIN32
+    segment_log segments_; // written by the event loops themselves, not this thread
+#endif
+
+    // what turning records into text needs, kept from one record to the next
+    struct formatter
+    {
+        hex_dumper dumper;
+        log_clock clock;
+        std::string prefix;
+    };
+
+    void format(std::string& out, formatter& f, const log_record& r)
+    {
+        if (r.kind == log_kind_packet)
+        {
+            capture_.packet(r.time, r.source, r.destination, r.seq, r.ack, r.payload, r.length);
+            return;
+        }
+
+        if (r.kind == log_kind_line)
+        {
+            out.append((const char*) r.payload, r.length);
+            out += '\n';
+            return;
+        }
+
+        f.prefix.clear();
+        if (report_time)
+            f.prefix += f.clock.format(r.time);
+        f.prefix += r.dir_in ? '>' : '<';
+        f.prefix.append(r.endpoint, r.endpoint_length);
+
+        if (r.kind == log_kind_data)
+        {
+            f.dumper.format(out, f.prefix.data(), f.prefix.size(), report_width, report_repeats, r.payload, r.length);
+        }
+        else
+        {
+            out += f.prefix;
+            out.append((const char*) r.payload, r.length);
+            out += '\n';
+        }
+    }
+
+    void write_batch(std::string& batch)
+    {
+        fwrite(batch.data(), 1, batch.size(), stdout);
+        fflush(stdout);
+        batch.clear();
+    }
+
+    void run()
+    {
+        formatter f;
+        std::string batch;
+        batch.reserve(1 << 21);
+        uint64_t reported = 0;
+        for (;;)
+        {
+            size_t taken = 0;
+            while (log_record* r = queue_->front())
+            {
+                format(batch, f, *r);
+                queue_->pop();
+                taken++;
+                if (batch.size() > (1 << 20))
+                    write_batch(batch);
+            }
+
+            uint64_t dropped = dropped_;
+            if (dropped != reported)
+            {
+                batch += "dropped " + std::to_string(dropped - reported) + " log records\n";
+                reported = dropped;
+            }
+
+            if (!batch.empty())
+                write_batch(batch);
+
+            if (taken == 0)
+            {
+                capture_.flush();
+                if (!running_)
+                    break;
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                idle_ = true;
+                if (queue_->front() == nullptr)
+                    wake_.wait_for(lock, std::chrono::milliseconds(10));
+                idle_ = false;
+            }
+        }
+    }
+
+    void wake()
+    {
+        if (idle_.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wake_.notify_one();
+        }
+    }
+
+    static void fill(log_record& r, int kind, const std::string& endpoint, bool dir_in, const uint8_t* data, size_t length)
+    {
+        r.kind = kind;
+        r.dir_in = dir_in;
+        r.time = std::chrono::system_clock::now();
+        r.endpoint_length = std::min(endpoint.size(), log_endpoint_size);
+        memcpy(r.endpoint, endpoint.data(), r.endpoint_length);
+        r.length = std::min(length, log_payload_size);
+        memcpy(r.payload, data, r.length);
+    }
+
+    // not started, or already stopped: write it here and now
+    void write_now(const log_record& r)
+    {
+        formatter f;
+        std::string text;
+        format(text, f, r);
+        std::cout.write(text.data(), text.size());
+        std::cout.flush();
+        capture_.flush();
+    }
+
+    // a record to fill in and publish, nullptr when the queue is full and the policy is to drop
+    log_record* claim(size_t& ticket)
+    {
+        log_record* r = queue_->claim(ticket);
+        while (r == nullptr)
+        {
+            if (!block_)
+            {
+                dropped_++;
+                return nullptr;
+            }
+            wake();
+            std::this_thread::yield();
+            r = queue_->claim(ticket);
+        }
+        return r;
+    }
+
+    void publish(size_t ticket)
+    {
+        queue_->publish(ticket);
+        wake();
+    }
+
+    void push(int kind, const std::string& endpoint, bool dir_in, const uint8_t* data, size_t length)
+    {
+        if (!running_)
+        {
+            std::unique_ptr<log_record> r(new log_record);
+            fill(*r, kind, endpoint, dir_in, data, length);
+            write_now(*r);
+            return;
+        }
+
+        size_t ticket = 0;
+        if (log_record* r = claim(ticket))
+        {
+            fill(*r, kind, endpoint, dir_in, data, length);
+            publish(ticket);
+        }
+    }
+
+public:
+    log_writer() :
+        running_(false),
+        idle_(false),
+        dropped_(0),
+        block_(true)
+    {
+    }
+
+    ~log_writer()
+    {
+        stop();
+    }
+
+    // received data goes to this file as pcapng, instead of stdout as a hex dump
+    bool open_capture(const std::string& path)
+    {
+        return capture_.open(path);
+    }
+
+#ifndef _WIN32
+    // received data goes to rotating segment files that nosey-read turns back into the hex dump
+    bool open_segments(const std::string& base, size_t segment_bytes, int seconds, size_t keep)
+    {
+        return segments_.open(base, segment_bytes, seconds, keep);
+    }
+#endif
+
+    bool capturing() const
+    {
+#ifndef _WIN32
+        if (segments_.is_open())
+            return true;
+#endif
+        return capture_.is_open();
+    }
+
+    void start(size_t capacity, bool block)
+    {
+        queue_.reset(new log_queue<log_record>(capacity));
+        block_ = block;
+        running_ = true;
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    // drains what's queued before returning
+    void stop()
+    {
+        if (!running_)
+            return;
+        running_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wake_.notify_one();
+        }
+        thread_.join();
+        capture_.close();
+#ifndef _WIN32
+        segments_.close();
+#endif
+    }
+
+    uint64_t dropped() const
+    {
+#ifndef _WIN32
+        return dropped_ + segments_.lost();
+#else
+        return dropped_;
+#endif
+    }
+
+    // a received chunk, split at line boundaries so the dump reads the same as if it were one record
+    void data(const std::string& endpoint, bool dir_in, const uint8_t* data, size_t length)
+    {
+        size_t line = std::max(report_width * report_repeats, 1);
+        size_t chunk = std::max(log_payload_size / line, (size_t) 1) * line;
+        chunk = std::min(chunk, log_payload_size);
+        for (size_t offs = 0; offs < length; offs += chunk)
+            push(log_kind_data, endpoint, dir_in, data + offs, std::min(chunk, length - offs));
+    }
+
+    // a received chunk as TCP segments from source to destination, seq counts the bytes before it
+    // segment files take it straight from the calling thread, they need no writer thread
+    void packet(
+        uint64_t session,
+        bool dir_in,
+        const sockaddr_in& source,
+        const sockaddr_in& destination,
+        uint32_t seq,
+        uint32_t ack,
+        const uint8_t* data,
+        size_t length)
+    {
+#ifndef _WIN32
+        if (segments_.is_open())
+        {
+            segments_.append(session, dir_in, source, destination, std::chrono::system_clock::now(), data, length);
+            return;
+        }
+#endif
+        for (size_t offs = 0; offs < length; offs += log_payload_size)
+        {
+            size_t ticket = 0;
+            std::unique_ptr<log_record> local;
+            log_record* r = nullptr;
+            if (running_)
+            {
+                r = claim(ticket);
+            }
+            else
+            {
+                local.reset(new log_record);
+                r = local.get();
+            }
+            if (r == nullptr)
+                continue;
+
+            fill(*r, log_kind_packet, std::string(), true, data + offs, std::min(log_payload_size, length - offs));
+            r->source = source;
+            r->destination = destination;
+            r->seq = seq + (uint32_t) offs;
+            r->ack = ack;
+
+            if (local)
+                write_now(*r);
+            else
+                publish(ticket);
+        }
+    }
+
+    void event(const std::string& endpoint, bool dir_in, const std::string& text)
+    {
+        push(log_kind_event, endpoint, dir_in, (const uint8_t*) text.data(), text.size());
+    }
+
+    // a literal goes straight into the record, not through a std::string of its own
+    void event(const std::string& endpoint, bool dir_in, const char* text)
+    {
+        push(log_kind_event, endpoint, dir_in, (const uint8_t*) text, strlen(text));
+    }
+
+    void event(const sockaddr_in& addr, bool dir_in, const std::string& text)
+    {
+        event(log_endpoint(addr), dir_in, text);
+    }
+
+    void line(const std::string& text)
+    {
+        push(log_kind_line, std::string(), false, (const uint8_t*) text.data(), text.size());
+    }
+} logger;
+
+// every session adds its traffic here when it is reclaimed
+struct traffic_totals
+{
+    std::atomic<uint64_t> sessions;
+    std::atomic<uint64_t> bytes_upstream;
+    std::atomic<uint64_t> bytes_downstream;
+    std::atomic<uint64_t> forwards;
+    std::atomic<uint64_t> forward_ns;
+    std::atomic<uint64_t> forward_max_ns;
+    std::atomic<uint64_t> throttled_upstream;
+    std::atomic<uint64_t> throttled_downstream;
+    std::atomic<uint64_t> pool_hits;
+    std::atomic<uint64_t> pool_misses;
+} totals;
+
+// what of the traffic is logged at all, settled before anything is copied or formatted so an
+// always on dump or capture has a known cost: the sample is taken as each session starts, the
+// rate is a token bucket shared by every worker and refilled from the clock as it is drawn on
+class log_budget
+{
+    std::atomic<uint64_t> sessions_;
+    std::atomic<int64_t> tokens_;
+    std::atomic<int64_t> refilled_ns_;
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(io_clock::now().time_since_epoch()).count();
+    }
+
+    // a second's worth at most, so a quiet spell allows a burst of one second and no more
+    void refill()
+    {
+        int64_t now = now_ns();
+        int64_t last = refilled_ns_.load(std::memory_order_relaxed);
+        int64_t elapsed = std::min<int64_t>(now - last, 1000000000);
+        if ((elapsed < 100000) || !refilled_ns_.compare_exchange_strong(last, now, std::memory_order_relaxed))
+            return;
+
+        int64_t rate = (int64_t) log_rate;
+        int64_t added = elapsed * rate / 1000000000;
+        int64_t tokens = tokens_.load(std::memory_order_relaxed);
+        while (!tokens_.compare_exchange_weak(tokens, std::min(tokens + added, rate), std::memory_order_relaxed))
+        {
+        }
+    }
+
+public:
+    log_budget() :
+        sessions_(0),
+        tokens_(0),
+        refilled_ns_(0)
+    {
+    }
+
+    // whether a new session is one of the sampled ones
+    bool sample()
+    {
+        return (log_sample <= 1) || (sessions_.fetch_add(1, std::memory_order_relaxed) % log_sample == 0);
+    }
+
+    // how many of wanted bytes may be logged now
+    size_t take(size_t wanted)
+    {
+        if (log_rate == 0)
+            return wanted;
+
+        refill();
+        int64_t tokens = tokens_.load(std::memory_order_relaxed);
+        int64_t taken = 0;
+        do
+        {
+            taken = std::min<int64_t>(tokens, (int64_t) wanted);
+            if (taken <= 0)
+                return 0;
+        } while (!tokens_.compare_exchange_weak(tokens, tokens - taken, std::memory_order_relaxed));
+        return (size_t) taken;
+    }
+} log_allowance;
+
+void print_totals()
+{
+    uint64_t forwards = totals.forwards;
+    std::cout << std::dec << "relayed " << totals.sessions << " sessions, "
+        << totals.bytes_upstream << " bytes upstream, "
+        << totals.bytes_downstream << " bytes downstream, forward latency avg "
+        << (forwards ? totals.forward_ns / forwards / 1000 : 0) << "us max "
+        << totals.forward_max_ns / 1000 << "us, throttled "
+        << totals.throttled_upstream << " times upstream, "
+        << totals.throttled_downstream << " times downstream, "
+        << logger.dropped() << " log records dropped" << std::endl;
+
+    if (pool_min_idle > 0)
+    {
+        std::cout << "upstream pool: " << totals.pool_hits << " sessions took a ready connection, "
+            << totals.pool_misses << " had to connect" << std::endl;
+    }
+}
+
+// ip:port whatever the report options say, for metric labels
+std::string address_text(const sockaddr_in& addr)
+{
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, (void*) &addr.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+// a destination, shared by every worker
+struct backend
+{
+    size_t index; // in the set, and in each worker's pools
+    sockaddr_in addr; // the port only, for a destination given by name
+    dns_cache::entry* host; // nullptr for one given as an address
+    std::string name;
+    std::string address;
+    std::atomic<int> active; // sessions using it now
+    std::atomic<int> failures; // failed connects in a row
+    std::atomic<uint64_t> connect_failures; // ever
+    std::atomic<int64_t> ejected_until; // io_clock ticks, no new sessions before then
+
+    backend(size_t n, const sockaddr_in& a, dns_cache::entry* h) :
+        index(n),
+        addr(a),
+        host(h),
+        name((h == nullptr) ? log_endpoint(a) : h->host + ":" + std::to_string(ntohs(a.sin_port))),
+        address((h == nullptr) ? address_text(a) : name),
+        active(0),
+        failures(0),
+        connect_failures(0),
+        ejected_until(0)
+    {
+    }
+
+    // where to connect now, the last address its name resolved to; false until it has resolved
+    bool far_end(sockaddr_in& out) const
+    {
+        out = addr;
+        if (host == nullptr)
+            return true;
+        out.sin_addr.s_addr = host->ip.load(std::memory_order_relaxed);
+        return out.sin_addr.s_addr != 0;
+    }
+
+    bool resolved() const
+    {
+        return (host == nullptr) || (host->ip.load(std::memory_order_relaxed) != 0);
+    }
+};
+
+enum balance
+{
+    balance_round_robin,
+    balance_least_connections,
+    balance_hash // on the client's address, so a client keeps its backend while the set is healthy
+};
+
+// the destinations and how sessions are spread over them
+// a connect failure ejects a backend for a while, 1s doubling with every further failure up to
+// max_ejection; once that's up it gets sessions again, which is its retry
+class backend_set
+{
+    static const int hash_points = 64; // per backend on the hash ring
+    static const int max_ejection = 30; // seconds
+
+    std::vector<std::unique_ptr<backend>> backends_;
+    std::vector<std::pair<uint32_t, size_t>> ring_;
+    std::atomic<size_t> next_;
+    int policy_;
+
+    static uint32_t mix(uint32_t h)
+    {
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static int64_t now()
+    {
+        return io_clock::now().time_since_epoch().count();
+    }
+
+    bool available(size_t n, int64_t at, const backend* avoid) const
+    {
+        const backend& b = *backends_[n];
+        return (&b != avoid) && (b.ejected_until <= at) && b.resolved();
+    }
+
+public:
+    backend_set() :
+        next_(0),
+        policy_(balance_round_robin)
+    {
+    }
+
+    static int parse_policy(const std::string& name)
+    {
+        if (name == "round-robin")
+            return balance_round_robin;
+        if (name == "least-conn")
+            return balance_least_connections;
+        if (name == "hash")
+            return balance_hash;
+        return -1;
+    }
+
+    void set_policy(int policy)
+    {
+        policy_ = policy;
+    }
+
+    // host for a destination given by name, its place on the ring then follows the name, not the address
+    void add(const sockaddr_in& addr, dns_cache::entry* host = nullptr)
+    {
+        size_t n = backends_.size();
+        backends_.emplace_back(new backend(n, addr, host));
+        uint32_t identity = (host == nullptr) ? addr.sin_addr.s_addr : (uint32_t) std::hash<std::string>()(host->host);
+        for (uint32_t point = 0; point < hash_points; point++)
+            ring_.push_back({ mix(mix(identity) ^ mix((addr.sin_port << 8) + point)), n });
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    size_t size() const
+    {
+        return backends_.size();
+    }
+
+    backend& at(size_t n)
+    {
+        return *backends_[n];
+    }
+
+    // where a new session from client should go, never the one to avoid unless it's the only one
+    // when every backend is ejected the one due back soonest gets it, rather than nobody, though one
+    // whose name hasn't resolved only when none has
+    backend* pick(const sockaddr_in& client, const backend* avoid)
+    {
+        size_t count = backends_.size();
+        int64_t at = now();
+        size_t chosen = count;
+
+        if (policy_ == balance_hash)
+        {
+            auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(mix(client.sin_addr.s_addr), (size_t) 0));
+            for (size_t n = 0; (n < ring_.size()) && (chosen == count); n++, it++)
+            {
+                if (it == ring_.end())
+                    it = ring_.begin();
+                if (available(it->second, at, avoid))
+                    chosen = it->second;
+            }
+        }
+        else
+        {
+            size_t start = next_++;
+            for (size_t n = 0; n < count; n++)
+            {
+                size_t candidate = (start + n) % count;
+                if (!available(candidate, at, avoid))
+                    continue;
+                if (policy_ == balance_round_robin)
+                {
+                    chosen = candidate;
+                    break;
+                }
+                if ((chosen == count) || (backends_[candidate]->active < backends_[chosen]->active))
+                    chosen = candidate;
+            }
+        }
+
+        if (chosen == count)
+        {
+            for (size_t n = 0; n < count; n++)
+            {
+                if ((backends_[n].get() == avoid) && (count > 1))
+                    continue;
+                if ((chosen == count)
+                    || (backends_[n]->resolved() && !backends_[chosen]->resolved())
+                    || ((backends_[n]->resolved() == backends_[chosen]->resolved()) && (backends_[n]->ejected_until < backends_[chosen]->ejected_until)))
+                    chosen = n;
+            }
+        }
+        return backends_[chosen].get();
+    }
+
+    void failed(backend& b)
+    {
+        int failures = ++b.failures;
+        b.connect_failures++;
+        auto backoff = std::chrono::seconds(std::min(1 << std::min(failures - 1, 5), max_ejection));
+        b.ejected_until = now() + std::chrono::duration_cast<io_clock::duration>(backoff).count();
+    }
+
+    void succeeded(backend& b)
+    {
+        b.failures = 0;
+        b.ejected_until = 0;
+    }
+} backends;
+
+// what a worker counts for the metrics endpoint, only the worker writes it
+struct worker_metrics
+{
+    live_traffic clients; // the accepted side of its sessions
+    live_traffic backends; // the side it connected
+    std::atomic<uint64_t> sessions;
+    std::atomic<uint64_t> rejected;
+    latency_histogram connect_latency; // upstream connects, not the ones the pool made ahead of time
+    latency_histogram loop_turns; // time in handlers per event loop turn
+    std::atomic<uint64_t> log_unsampled; // sessions left out of the dump by --log-sample
+    std::atomic<uint64_t> log_over_limit; // bytes left out past --log-limit
+    std::atomic<uint64_t> log_over_rate; // bytes left out over --log-rate
+    std::atomic<uint64_t> idle_timeouts;
+    std::atomic<uint64_t> lifetime_timeouts;
+
+    worker_metrics() :
+        sessions(0),
+        rejected(0),
+        log_unsampled(0),
+        log_over_limit(0),
+        log_over_rate(0),
+        idle_timeouts(0),
+        lifetime_timeouts(0)
+    {
+    }
+};
+
+std::vector<std::unique_ptr<worker_metrics>> worker_stats;
+
+void print_log_skipped()
+{
+    uint64_t unsampled = 0, over_limit = 0, over_rate = 0;
+    for (auto& worker : worker_stats)
+    {
+        unsampled += worker->log_unsampled;
+        over_limit += worker->log_over_limit;
+        over_rate += worker->log_over_rate;
+    }
+    std::cout << "not logged: " << unsampled << " sessions outside the sample, "
+        << over_limit << " bytes past the per session limit, "
+        << over_rate << " bytes over the rate limit" << std::endl;
+}
+
+void metric_header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+void metric_value(std::string& out, const std::string& name, uint64_t value)
+{
+    out += name;
+    out += " ";
+    out += std::to_string(value);
+    out += "\n";
+}
+
+void metric_histogram(std::string& out, const char* name, const char* help, latency_histogram worker_metrics::* histogram)
+{
+    metric_header(out, name, "histogram", help);
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    char line[128];
+    for (int n = 0; n < latency_histogram::buckets; n++)
+    {
+        for (auto& worker : worker_stats)
+            count += ((*worker).*histogram).count(n);
+        if (n + 1 < latency_histogram::buckets)
+        {
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n", name, latency_histogram::upper_bound(n), (unsigned long long) count);
+            out += line;
+        }
+    }
+    for (auto& worker : worker_stats)
+        sum_ns += ((*worker).*histogram).sum_ns();
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) count);
+    out += line;
+    snprintf(line, sizeof(line), "%s_sum %.9g\n", name, sum_ns / 1e9);
+    out += line;
+    snprintf(line, sizeof(line), "%s_count %llu\n", name, (unsigned long long) count);
+    out += line;
+}
+
+// the prometheus text exposition, read from counters the relay never waits for
+std::string render_metrics()
+{
+    uint64_t sessions = 0, rejected = 0;
+    uint64_t received_upstream = 0, received_downstream = 0, sent_upstream = 0, sent_downstream = 0;
+    uint64_t queued_upstream = 0, queued_downstream = 0;
+    uint64_t log_unsampled = 0, log_over_limit = 0, log_over_rate = 0;
+    uint64_t idle_timeouts = 0, lifetime_timeouts = 0;
+    for (auto& worker : worker_stats)
+    {
+        idle_timeouts += worker->idle_timeouts;
+        lifetime_timeouts += worker->lifetime_timeouts;
+        log_unsampled += worker->log_unsampled;
+        log_over_limit += worker->log_over_limit;
+        log_over_rate += worker->log_over_rate;
+        sessions += worker->sessions;
+        rejected += worker->rejected;
+        received_upstream += worker->clients.bytes_received;
+        sent_downstream += worker->clients.bytes_sent;
+        received_downstream += worker->backends.bytes_received;
+        sent_upstream += worker->backends.bytes_sent;
+        queued_downstream = std::max<uint64_t>(queued_downstream, worker->clients.queued_max);
+        queued_upstream = std::max<uint64_t>(queued_upstream, worker->backends.queued_max);
+    }
+
+    std::string out;
+    metric_header(out, "nosey_sessions_active", "gauge", "Sessions open now.");
+    metric_value(out, "nosey_sessions_active", active_sessions);
+    metric_header(out, "nosey_sessions_total", "counter", "Sessions accepted.");
+    metric_value(out, "nosey_sessions_total", sessions);
+    metric_header(out, "nosey_sessions_rejected_total", "counter", "Clients turned away at the session limit.");
+    metric_value(out, "nosey_sessions_rejected_total", rejected);
+    metric_header(out, "nosey_sessions_timed_out_total", "counter", "Sessions closed by --idle-timeout or --max-lifetime.");
+    metric_value(out, "nosey_sessions_timed_out_total{reason=\"idle\"}", idle_timeouts);
+    metric_value(out, "nosey_sessions_timed_out_total{reason=\"lifetime\"}", lifetime_timeouts);
+
+    metric_header(out, "nosey_received_bytes_total", "counter", "Bytes read, upstream from clients and downstream from backends.");
+    metric_value(out, "nosey_received_bytes_total{direction=\"upstream\"}", received_upstream);
+    metric_value(out, "nosey_received_bytes_total{direction=\"downstream\"}", received_downstream);
+    metric_header(out, "nosey_sent_bytes_total", "counter", "Bytes written, upstream to backends and downstream to clients.");
+    metric_value(out, "nosey_sent_bytes_total{direction=\"upstream\"}", sent_upstream);
+    metric_value(out, "nosey_sent_bytes_total{direction=\"downstream\"}", sent_downstream);
+    metric_header(out, "nosey_write_queue_max_bytes", "gauge", "The most one connection has had queued, splice relay aside.");
+    metric_value(out, "nosey_write_queue_max_bytes{direction=\"upstream\"}", queued_upstream);
+    metric_value(out, "nosey_write_queue_max_bytes{direction=\"downstream\"}", queued_downstream);
+
+    int64_t now = io_clock::now().time_since_epoch().count();
+    metric_header(out, "nosey_backend_active_sessions", "gauge", "Sessions using each backend.");
+    for (size_t n = 0; n < backends.size(); n++)
+        metric_value(out, "nosey_backend_active_sessions{backend=\"" + backends.at(n).address + "\"}", std::max(backends.at(n).active.load(), 0));
+    metric_header(out, "nosey_backend_connect_failures_total", "counter", "Failed connects to each backend.");
+    for (size_t n = 0; n < backends.size(); n++)
+        metric_value(out, "nosey_backend_connect_failures_total{backend=\"" + backends.at(n).address + "\"}", backends.at(n).connect_failures);
+    metric_header(out, "nosey_backend_ejected", "gauge", "1 while a backend is skipped after failed connects.");
+    for (size_t n = 0; n < backends.size(); n++)
+        metric_value(out, "nosey_backend_ejected{backend=\"" + backends.at(n).address + "\"}", backends.at(n).ejected_until > now ? 1 : 0);
+    if (host_names.size() > 0)
+    {
+        metric_header(out, "nosey_dns_lookups_total", "counter", "Lookups of each destination host name.");
+        for (size_t n = 0; n < host_names.size(); n++)
+            metric_value(out, "nosey_dns_lookups_total{host=\"" + host_names.at(n).host + "\"}", host_names.at(n).lookups);
+        metric_header(out, "nosey_dns_failures_total", "counter", "Lookups of each destination host name that failed.");
+        for (size_t n = 0; n < host_names.size(); n++)
+            metric_value(out, "nosey_dns_failures_total{host=\"" + host_names.at(n).host + "\"}", host_names.at(n).failures);
+    }
+
+    metric_header(out, "nosey_pool_hits_total", "counter", "Sessions that took a ready upstream connection.");
+    metric_value(out, "nosey_pool_hits_total", totals.pool_hits);
+    metric_header(out, "nosey_pool_misses_total", "counter", "Sessions that found the upstream pool empty.");
+    metric_value(out, "nosey_pool_misses_total", totals.pool_misses);
+    metric_header(out, "nosey_log_records_dropped_total", "counter", "Log records dropped with --log-drop.");
+    metric_value(out, "nosey_log_records_dropped_total", logger.dropped());
+    metric_header(out, "nosey_log_unsampled_sessions_total", "counter", "Sessions not logged with --log-sample.");
+    metric_value(out, "nosey_log_unsampled_sessions_total", log_unsampled);
+    metric_header(out, "nosey_log_skipped_bytes_total", "counter", "Received bytes of logged sessions left out of the log.");
+    metric_value(out, "nosey_log_skipped_bytes_total{reason=\"limit\"}", log_over_limit);
+    metric_value(out, "nosey_log_skipped_bytes_total{reason=\"rate\"}", log_over_rate);
+
+    metric_histogram(out, "nosey_upstream_connect_seconds", "Time to connect to a backend.", &worker_metrics::connect_latency);
+    metric_histogram(out, "nosey_loop_turn_seconds", "Time an event loop spent running handlers per turn.", &worker_metrics::loop_turns);
+    return out;
+}
+
+// upstream connections opened ahead of time, so an accepted client can be paired with one at once
+// a worker has one pool on its own reactor; it keeps at least min_idle ready, and grows towards
+// max_idle when sessions find it empty, shrinking back as connections sit unused past the idle timeout
+class upstream_pool
+{
+    struct pooled : public io_handler
+    {
+        upstream_pool& pool_;
+        SOCKET fd_;
+        bool connecting_;
+        io_clock::time_point since_;
+
+        pooled(upstream_pool& pool, SOCKET fd) :
+            pool_(pool),
+            fd_(fd),
+            connecting_(true),
+            since_(io_clock::now())
+        {
+        }
+
+        void on_io(int events) override
+        {
+            pool_.on_io(this, events);
+        }
+    };
+
+    reactor& reactor_;
+    backend& backend_;
+    sockaddr_in far_end_;
+    std::vector<std::unique_ptr<pooled>> sockets_; // connecting and idle, the most recently ready last
+    size_t target_;
+
+    // the far end hasn't closed or reset it; data waiting is fine (a banner, say) and goes to the client
+    static bool healthy(SOCKET fd)
+    {
+        char c;
+        int r = recv(fd, &c, 1, MSG_PEEK);
+        if (r > 0)
+            return true;
+#ifdef _WIN32
+        return (r < 0) && (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+        return (r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+#endif
+    }
+
+    void drop(pooled* p)
+    {
+        reactor_.remove(p->fd_);
+        cleanup_socket(p->fd_);
+        for (size_t n = 0; n < sockets_.size(); n++)
+        {
+            if (sockets_[n].get() == p)
+            {
+                sockets_.erase(sockets_.begin() + n);
+                break;
+            }
+        }
+    }
+
+    void on_io(pooled* p, int events)
+    {
+        if (p->connecting_)
+        {
+            if (!(events & (io_writable | io_hangup)))
+                return;
+
+            int r = ::connect(p->fd_, (sockaddr*) &far_end_, sizeof(sockaddr_in));
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEISCONN)
+#else
+            if ((r == 0) || (errno == EISCONN))
+#endif
+            {
+                p->connecting_ = false;
+                p->since_ = io_clock::now();
+                backends.succeeded(backend_);
+                reactor_.update(p->fd_, p, io_readable);
+                return;
+            }
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+            if ((errno == EAGAIN) || (errno == EALREADY) || (errno == EINPROGRESS) || (errno == EWOULDBLOCK))
+#endif
+                return;
+
+            backends.failed(backend_);
+            drop(p);
+            return;
+        }
+
+        if (!healthy(p->fd_))
+        {
+            drop(p);
+            refill();
+            return;
+        }
+
+        // something arrived early, wait for hangups only so a level triggered reactor doesn't spin on it
+        reactor_.update(p->fd_, p, 0);
+    }
+
+    void refill()
+    {
+        // an ejected backend gets a rest from the pool too, and one given by name follows its address
+        if (backend_.ejected_until > io_clock::now().time_since_epoch().count())
+            return;
+        if (!backend_.far_end(far_end_))
+            return;
+
+        while (sockets_.size() < target_)
+        {
+            SOCKET fd = open_stream_socket();
+            if (fd == INVALID_SOCKET)
+                return;
+            tune_connection(fd, true);
+
+            sockets_.emplace_back(new pooled(*this, fd));
+            pooled* p = sockets_.back().get();
+            // the newest sockets go to the front, take() hands out the ones at the back first
+            std::rotate(sockets_.begin(), sockets_.end() - 1, sockets_.end());
+            reactor_.add(fd, p, io_writable);
+            ::connect(fd, (sockaddr*) &far_end_, sizeof(sockaddr_in));
+            reactor_.post(fd, p, io_writable);
+        }
+    }
+
+    upstream_pool(const upstream_pool&) = delete;
+    void operator=(const upstream_pool&) = delete;
+
+public:
+    upstream_pool(reactor& r, backend& b) :
+        reactor_(r),
+        backend_(b),
+        far_end_(b.addr),
+        target_(pool_min_idle)
+    {
+        refill();
+    }
+
+    ~upstream_pool()
+    {
+        for (auto& p : sockets_)
+        {
+            reactor_.remove(p->fd_);
+            cleanup_socket(p->fd_);
+        }
+    }
+
+    // a connected socket for a new session, or INVALID_SOCKET when none is ready
+    SOCKET take()
+    {
+        SOCKET fd = INVALID_SOCKET;
+        for (size_t n = sockets_.size(); n-- > 0;)
+        {
+            pooled* p = sockets_[n].get();
+            if (p->connecting_)
+                continue;
+
+            reactor_.remove(p->fd_);
+            if (healthy(p->fd_))
+                fd = p->fd_;
+            else
+                cleanup_socket(p->fd_);
+            sockets_.erase(sockets_.begin() + n);
+            if (fd != INVALID_SOCKET)
+                break;
+        }
+
+        if (fd != INVALID_SOCKET)
+        {
+            totals.pool_hits++;
+        }
+        else
+        {
+            totals.pool_misses++;
+            target_ = std::min(std::max(target_ * 2, (size_t) 1), std::max(pool_max_idle, pool_min_idle));
+        }
+        refill();
+        return fd;
+    }
+
+    // once a turn: close what has sat unused for too long, and top the pool back up
+    void maintain()
+    {
+        auto now = io_clock::now();
+        auto expired = now - std::chrono::seconds(pool_idle_timeout);
+        auto hung = now - std::chrono::seconds(connect_timeout);
+        for (size_t n = sockets_.size(); n-- > 0;)
+        {
+            pooled* p = sockets_[n].get();
+            if (!p->connecting_ && (p->since_ < expired))
+            {
+                drop(p);
+                target_ = std::max(target_ - 1, pool_min_idle);
+            }
+            else if (p->connecting_ && (connect_timeout > 0) && (p->since_ < hung))
+            {
+                backends.failed(backend_);
+                drop(p);
+            }
+        }
+        refill();
+    }
+};
+
+class connector
+{
+    // what each side reports goes straight to the connector, called directly rather than through
+    // a std::function so the relay of every chunk can be inlined
+    struct server_events
+    {
+        connector* owner;
+
+        explicit server_events(connector* c) :
+            owner(c)
+        {
+        }
+
+        void on_connect()
+        {
+            owner->on_server_accept();
+        }
+
+        void on_receive(const uint8_t* data, int length)
+        {
+            owner->on_server_recv(data, length);
+        }
+
+        void on_disconnect()
+        {
+            owner->on_server_disconnect();
+        }
+    };
+
+    struct client_events
+    {
+        connector* owner;
+
+        explicit client_events(connector* c) :
+            owner(c)
+        {
+        }
+
+        void on_connect()
+        {
+            owner->on_client_connect();
+        }
+
+        void on_receive(const uint8_t* data, int length)
+        {
+            owner->on_client_recv(data, length);
+        }
+
+        void on_disconnect()
+        {
+            owner->on_client_disconnect();
+        }
+
+        bool on_connect_failed()
+        {
+            return owner->on_client_connect_failed();
+        }
+    };
+
+    sockaddr_in server_near_;
+    sockaddr_in server_far_;
+    sockaddr_in client_near_;
+    sockaddr_in client_far_;
+    std::string server_name_; // log_endpoint of each far end
+    std::string client_name_;
+    uint64_t session_; // numbered from 1 as sessions start, for segment files
+    uint32_t upstream_seq_; // bytes relayed each way, as sequence numbers for the capture
+    uint32_t downstream_seq_;
+    basic_server_connection<server_events> server_;
+    basic_client_connection<client_events> client_;
+    std::function<void (connector*)> on_closing_;
+    const std::vector<std::unique_ptr<upstream_pool>>& pools_; // one per backend, or none
+    worker_metrics& metrics_;
+    backend* backend_;
+    size_t attempts_;
+    io_clock::time_point connect_started_; // while connecting, not when the pool had one ready
+    std::unique_ptr<message_filter> upstream_filter_; // when the dump is framed into messages
+    std::unique_ptr<message_filter> downstream_filter_;
+    reactor& reactor_;
+    io_clock::time_point accepted_at_;
+    timer idle_timer_;
+    timer lifetime_timer_;
+    bool closing_;
+    bool logging_; // a dump or capture is on and this session is in the sample
+    size_t log_left_[2]; // bytes each direction may still log under --log-limit, indexed by dir_in
+
+    void closing()
+    {
+        if (!closing_)
+        {
+            closing_ = true;
+            idle_timer_.cancel();
+            lifetime_timer_.cancel();
+            on_closing_(this);
+        }
+    }
+
+    // nothing read either way since the timer was set, or read since and it waits out the rest
+    void on_idle_timer()
+    {
+        auto last = std::max(accepted_at_, std::max(server_.last_receive(), client_.last_receive()));
+        auto deadline = last + std::chrono::seconds(idle_timeout);
+        auto now = io_clock::now();
+        if (deadline > now)
+        {
+            idle_timer_.arm(reactor_.timers(), deadline - now);
+            return;
+        }
+        live_add(metrics_.idle_timeouts, 1);
+        expire(" idle timeout");
+    }
+
+    // both sides go at once, whatever is still queued for them
+    void expire(const char* reason)
+    {
+        logger.event(server_name_, true, reason);
+        server_.disconnect();
+        client_.disconnect();
+        closing();
+    }
+
+    // how much of a received chunk to log, counting what is left out
+    size_t log_share(bool dir_in, size_t length)
+    {
+        size_t n = length;
+        if (log_limit > 0)
+        {
+            n = std::min(n, log_left_[dir_in]);
+            log_left_[dir_in] -= n;
+            live_add(metrics_.log_over_limit, length - n);
+        }
+        if (n > 0)
+        {
+            size_t allowed = log_allowance.take(n);
+            live_add(metrics_.log_over_rate, n - allowed);
+            n = allowed;
+        }
+        return n;
+    }
+
+    // false when no backend has an address to go to yet, their names haven't resolved
+    bool choose_backend(const backend* avoid)
+    {
+        if (backend_ != nullptr)
+            backend_->active--;
+        backend_ = backends.pick(server_far_, avoid);
+        backend_->active++;
+        client_name_ = backend_->name;
+        return backend_->far_end(client_far_);
+    }
+
+public:
+
+    void on_client_recv(const uint8_t* data, int length)
+    {
+        if (logging_)
+        {
+            if (logger.capturing())
+            {
+                // the sequence numbers still count what was left out, so it shows as missing segments
+                size_t n = log_share(false, length);
+                if (n > 0)
+                    logger.packet(session_, false, client_far_, server_far_, downstream_seq_, upstream_seq_, data, n);
+                downstream_seq_ += length;
+            }
+            else if (downstream_filter_)
+            {
+                downstream_filter_->feed(data, length);
+            }
+            else
+            {
+                size_t n = log_share(false, length);
+                if (n > 0)
+                    logger.data(client_name_, false, data, n);
+            }
+        }
+        server_.send(data, length, client_.last_receive());
+        server_.hold_back(&client_);
+    }
+
+    void on_client_connect()
+    {
+        client_near_ = client_.get_near_end();
+        client_far_ = client_.get_far_end();
+        client_name_ = log_endpoint(client_far_);
+        backends.succeeded(*backend_);
+        if (connect_started_ != io_clock::time_point())
+        {
+            metrics_.connect_latency.record(io_clock::now() - connect_started_);
+            connect_started_ = io_clock::time_point();
+        }
+        logger.event(client_name_, true, " connected successfully");
+    }
+
+    // fail over while nothing has been relayed yet, each backend gets one go
+    bool on_client_connect_failed()
+    {
+        backends.failed(*backend_);
+        logger.event(client_name_, true, " connect failed");
+        if (closing_ || (++attempts_ >= backends.size()))
+            return false;
+
+        if (!choose_backend(backend_))
+        {
+            logger.event(client_name_, true, " not resolved");
+            return false;
+        }
+        logger.event(client_name_, true, " connecting ...");
+        connect_started_ = io_clock::now();
+        client_.redirect(client_far_);
+        return true;
+    }
+
+    void on_client_disconnect()
+    {
+        client_.disconnect(); //to stop it from reconnecting
+        server_.close_after_flush();
+
+        logger.event(client_name_, false, " disconnect");
+        logger.event(server_name_, false, " disconnect");
+        closing();
+    }
+
+    void on_server_recv(const uint8_t* data, int length)
+    {
+        if (logging_)
+        {
+            if (logger.capturing())
+            {
+                size_t n = log_share(true, length);
+                if (n > 0)
+                    logger.packet(session_, true, server_far_, client_far_, upstream_seq_, downstream_seq_, data, n);
+                upstream_seq_ += length;
+            }
+            else if (upstream_filter_)
+            {
+                upstream_filter_->feed(data, length);
+            }
+            else
+            {
+                size_t n = log_share(true, length);
+                if (n > 0)
+                    logger.data(server_name_, true, data, n);
+            }
+        }
+        client_.send(data, length, server_.last_receive());
+        client_.hold_back(&server_);
+    }
+
+    void on_server_accept()
+    {
+        // last_receive is only moved by reads, so one timer check per idle period covers any amount of traffic
+        accepted_at_ = io_clock::now();
+        if (idle_timeout > 0)
+            idle_timer_.arm(reactor_.timers(), std::chrono::seconds(idle_timeout));
+        if (session_lifetime > 0)
+            lifetime_timer_.arm(reactor_.timers(), std::chrono::seconds(session_lifetime));
+
+        server_near_ = server_.get_near_end();
+        server_far_ = server_.get_far_end();
+        server_name_ = log_endpoint(server_far_);
+        logger.event(server_name_, true, " accepted connection");
+        attempts_ = 0;
+        if (!choose_backend(nullptr))
+        {
+            logger.event(client_name_, true, " not resolved");
+            server_.disconnect();
+            closing();
+            return;
+        }
+        SOCKET pooled = pools_.empty() ? INVALID_SOCKET : pools_[backend_->index]->take();
+        if (pooled != INVALID_SOCKET)
+        {
+            client_.adopt(pooled, client_far_);
+            return;
+        }
+
+        logger.event(client_name_, true, " connecting ...");
+        connect_started_ = io_clock::now();
+        client_.connect(client_far_);
+    }
+
+    void on_server_disconnect()
+    {
+        logger.event(server_name_, true, " disconnect");
+        logger.event(client_name_, true, " disconnect");
+
+        server_.disconnect();
+        if (client_.is_active())
+            client_.close_after_flush();
+        else
+            client_.disconnect();
+        closing();
+    }
+
+    connector() = delete;
+
+    connector(connector&& c) = delete;
+
+    connector(
+        reactor& r,
+        std::function<void (connector*)> on_closing,
+        const std::vector<std::unique_ptr<upstream_pool>>& pools,
+        worker_metrics& metrics
+    ):
+        server_near_({0}),
+        server_far_({0}),
+        client_near_({0}),
+        client_far_({0}),
+        session_(++session_count),
+        upstream_seq_(1),
+        downstream_seq_(1),
+        server_(r, this),
+        client_(r, this),
+        on_closing_(on_closing),
+        pools_(pools),
+        metrics_(metrics),
+        backend_(nullptr),
+        attempts_(0),
+        reactor_(r),
+        idle_timer_([this]()
+            {
+                on_idle_timer();
+            }),
+        lifetime_timer_([this]()
+            {
+                live_add(metrics_.lifetime_timeouts, 1);
+                expire(" session lifetime reached");
+            }),
+        closing_(false),
+        logging_(dump_data || logger.capturing())
+    {
+        server_.count_into(&metrics_.clients);
+        client_.set_connect_timeout(std::chrono::seconds(connect_timeout));
+        client_.count_into(&metrics_.backends);
+        log_left_[0] = log_left_[1] = log_limit;
+        if (logging_ && !log_allowance.sample())
+        {
+            logging_ = false;
+            live_add(metrics_.log_unsampled, 1);
+        }
+        if (logging_ && !logger.capturing() && ((frame_spec != "none") || !log_pattern.empty() || log_headers_only))
+        {
+            // the limits apply to what gets through the filter, the decoder has to see every byte
+            upstream_filter_.reset(new message_filter(make_decoder(frame_spec), log_pattern, log_headers_only,
+                [this](const uint8_t* data, size_t length)
+                {
+                    size_t n = log_share(true, length);
+                    if (n > 0)
+                        logger.data(server_name_, true, data, n);
+                }));
+            downstream_filter_.reset(new message_filter(make_decoder(frame_spec), log_pattern, log_headers_only,
+                [this](const uint8_t* data, size_t length)
+                {
+                    size_t n = log_share(false, length);
+                    if (n > 0)
+                        logger.data(client_name_, false, data, n);
+                }));
+        }
+#ifdef __linux__
+        // nothing to look at, so the payload can skip user space altogether
+        if (!logging_ && use_splice && server_.relay_to(&client_))
+            client_.relay_to(&server_);
+#endif
+    }
+
+    ~connector()
+    {
+        if (backend_ != nullptr)
+            backend_->active--;
+    }
+
+    void accept(SOCKET fd)
+    {
+        server_.accept(fd);
+    }
+
+    // both sides have closed, the session can be reclaimed
+    bool is_closed() const
+    {
+        return !server_.is_open() && !client_.is_active();
+    }
+
+    // fold this session's traffic into the totals, once, when it is reclaimed
+    void account()
+    {
+        const traffic_stats& up = client_.stats();
+        const traffic_stats& down = server_.stats();
+        uint64_t forwards = up.forwards + down.forwards;
+        uint64_t forward_ns = up.forward_ns + down.forward_ns;
+        uint64_t forward_max_ns = std::max(up.forward_max_ns, down.forward_max_ns);
+
+        totals.sessions++;
+        totals.bytes_upstream += up.bytes_sent;
+        totals.bytes_downstream += down.bytes_sent;
+        totals.forwards += forwards;
+        totals.forward_ns += forward_ns;
+        totals.throttled_upstream += down.throttles;
+        totals.throttled_downstream += up.throttles;
+        uint64_t seen = totals.forward_max_ns;
+        while ((seen < forward_max_ns) && !totals.forward_max_ns.compare_exchange_weak(seen, forward_max_ns))
+        {
+        }
+
+        if (verbose)
+        {
+            std::stringstream ss;
+            ss << " relayed " << up.bytes_sent << " bytes upstream, "
+                << down.bytes_sent << " bytes downstream, forward latency avg "
+                << (forwards ? forward_ns / forwards / 1000 : 0) << "us max "
+                << forward_max_ns / 1000 << "us, throttled "
+                << down.throttles << " times upstream, "
+                << up.throttles << " times downstream";
+            logger.event(server_name_, true, ss.str());
+        }
+    }
+};
+
+class acceptor : public io_handler
+{
+    reactor& reactor_;
+    SOCKET fd_;
+    std::function<void (SOCKET, const sockaddr_in&)> on_accept_;
+    bool starved_;
+
+public:
+    acceptor(
+        reactor& r,
+        SOCKET fd,
+        std::function<void (SOCKET, const sockaddr_in&)> on_accept
+    ) :
+        reactor_(r),
+        fd_(fd),
+        on_accept_(on_accept),
+        starved_(false)
+    {
+        reactor_.add(fd_, this, io_readable);
+    }
+
+    ~acceptor()
+    {
+        reactor_.remove(fd_);
+    }
+
+    void on_io(int events) override
+    {
+        starved_ = false;
+        for (;;)
+        {
+            sockaddr_in far_end = {0};
+            SOCKET accepted = accept_socket(fd_, &far_end);
+            if (accepted != INVALID_SOCKET)
+            {
+                on_accept_(accepted, far_end);
+                continue;
+            }
+#ifndef _WIN32
+            // out of descriptors, the backlog waits until a session gives one back
+            starved_ = (errno == EMFILE) || (errno == ENFILE);
+#endif
+            return;
+        }
+    }
+
+    // descriptors were released, pick up the clients we couldn't take before
+    void resume()
+    {
+        if (starved_)
+            reactor_.post(fd_, this, io_readable);
+    }
+};
+
+// the metrics endpoint: plain HTTP on its own local port, answered on the first worker's event loop
+class metrics_server : public io_handler
+{
+    static const size_t max_request = 8192;
+    static const int scrape_timeout = 10; // seconds to send the request and read the answer
+
+    struct scrape
+    {
+        std::string request;
+        std::unique_ptr<server_connection> connection;
+        timer deadline; // so a client that never finishes its request doesn't hold a connection for good
+
+        scrape() :
+            deadline([this]()
+                {
+                    connection->disconnect();
+                })
+        {
+        }
+    };
+
+    reactor& reactor_;
+    SOCKET fd_;
+    std::vector<std::unique_ptr<scrape>> scrapes_;
+
+    // answers once the request headers are in, then closes, keep-alive isn't worth it here
+    static void on_request(scrape& s, const uint8_t* data, int length)
+    {
+        if (s.request.size() + length > max_request)
+        {
+            s.connection->disconnect();
+            return;
+        }
+        s.request.append((const char*) data, length);
+        if ((s.request.find("\r\n\r\n") == std::string::npos) && (s.request.find("\n\n") == std::string::npos))
+            return;
+
+        std::string status = "200 OK";
+        std::string body;
+        if ((s.request.compare(0, 13, "GET /metrics ") == 0) || (s.request.compare(0, 6, "GET / ") == 0))
+            body = render_metrics();
+        else
+            status = "404 Not Found";
+
+        std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+            + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        s.connection->send((const uint8_t*) response.data(), (int) response.size());
+        s.connection->close_after_flush();
+    }
+
+public:
+    metrics_server(reactor& r, SOCKET fd) :
+        reactor_(r),
+        fd_(fd)
+    {
+        reactor_.add(fd_, this, io_readable);
+    }
+
+    ~metrics_server()
+    {
+        scrapes_.clear();
+        reactor_.remove(fd_);
+    }
+
+    void on_io(int events) override
+    {
+        for (;;)
+        {
+            SOCKET accepted = accept_socket(fd_, nullptr);
+            if (accepted == INVALID_SOCKET)
+                return;
+
+            std::unique_ptr<scrape> s(new scrape());
+            scrape* p = s.get();
+            s->connection.reset(new server_connection(
+                reactor_,
+                []()
+                {
+                },
+                [p](const uint8_t* data, int length)
+                {
+                    on_request(*p, data, length);
+                },
+                []()
+                {
+                }));
+            scrapes_.push_back(std::move(s));
+            p->connection->accept(accepted);
+            p->deadline.arm(reactor_.timers(), std::chrono::seconds(scrape_timeout));
+        }
+    }
+
+    // drop the scrapes that have been answered or gone away
+    void reap()
+    {
+        scrapes_.erase(
+            std::remove_if(
+                scrapes_.begin(),
+                scrapes_.end(),
+                [](const std::unique_ptr<scrape>& s) { return !s->connection->is_open(); }),
+            scrapes_.end());
+    }
+};
+
+SOCKET metrics_listener = INVALID_SOCKET;
+
+void run_listener(SOCKET fd, worker_metrics& metrics, SOCKET metrics_fd)
+{
+    std::unique_ptr<reactor> events = make_reactor(reactor_backend);
+    slab<connector> sessions; // once it has grown to the busiest moment, sessions come without the heap
+    std::vector<connector*> closing;
+    std::vector<std::unique_ptr<upstream_pool>> pools;
+    if (pool_min_idle > 0)
+    {
+        for (size_t n = 0; n < backends.size(); n++)
+            pools.emplace_back(new upstream_pool(*events, backends.at(n)));
+    }
+
+    auto on_closing = [&closing](connector* session)
+    {
+        closing.push_back(session);
+    };
+
+    std::unique_ptr<metrics_server> scrapes;
+    if (metrics_fd != INVALID_SOCKET)
+        scrapes.reset(new metrics_server(*events, metrics_fd));
+
+    acceptor listener(*events, fd, [&](SOCKET accepted, const sockaddr_in& far_end)
+    {
+        // the place is taken in the same step as the count is checked, so loops accepting at once can't overshoot
+        size_t active = active_sessions.fetch_add(1);
+        if ((max_sessions > 0) && (active >= max_sessions))
+        {
+            // admission control: turn the client away now rather than leave it queued behind the backlog
+            active_sessions--;
+            logger.event(far_end, true, " rejected connection, " + std::to_string(active) + " sessions active");
+            cleanup_socket(accepted);
+            live_add(metrics.rejected, 1);
+            return;
+        }
+
+        live_add(metrics.sessions, 1);
+        connector* session = sessions.create(*events, on_closing, pools, metrics);
+        session->accept(accepted);
+    });
+
+    while (!stop_requested)
+    {
+        events->wait(1000);
+        if (events->last_turn().count() > 0)
+            metrics.loop_turns.record(events->last_turn());
+        for (auto& pool : pools)
+            pool->maintain();
+        if (scrapes)
+            scrapes->reap();
+
+        // only sessions that started closing are looked at, the rest cost nothing per turn
+        size_t kept = 0;
+        for (auto session : closing)
+        {
+            if (session->is_closed())
+            {
+                session->account();
+                sessions.destroy(session);
+                active_sessions--;
+            }
+            else
+                closing[kept++] = session;
+        }
+        if (kept != closing.size())
+        {
+            closing.resize(kept);
+            listener.resume();
+        }
+    }
+
+    sessions.for_each([](connector* session)
+        {
+            session->account();
+        });
+    active_sessions -= sessions.size();
+}
+
+// a nonblocking listening socket, with several workers each has one of its own on the same
+// port and the kernel spreads new connections over them
+SOCKET open_listener(const sockaddr_in& listen_addr, bool shared)
+{
+    SOCKET fd = open_stream_socket();
+    tune_listener(fd);
+
+#ifdef SO_REUSEPORT
+    if (shared)
+    {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char*) &on, sizeof(on));
+    }
+#endif
+
+    if (bind(fd, (sockaddr*) &listen_addr, sizeof(sockaddr_in)) != 0)
+    {
+        std::cerr << "could not bind to port" << std::endl;
+        cleanup_socket(fd);
+        return INVALID_SOCKET;
+    }
+
+    if (listen(fd, tcp_tuning.backlog) != 0)
+    {
+        std::cout << "failure to listen" << std::endl;
+        cleanup_socket(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// keeps the calling thread, worker n, on cpu n, wrapping round when there are more workers than cpus
+void pin_worker(int n)
+{
+#ifdef __linux__
+    int cpus = std::max((int) std::thread::hardware_concurrency(), 1);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(n % cpus, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+void run_worker(int n, SOCKET fd)
+{
+    if (pin_workers)
+        pin_worker(n);
+    run_listener(fd, *worker_stats[n], (n == 0) ? metrics_listener : INVALID_SOCKET);
+}
+
+// C style escapes, so a pattern can hold any byte
+std::string unescape(const std::string& text)
+{
+    std::string bytes;
+    for (size_t n = 0; n < text.size(); n++)
+    {
+        if ((text[n] != '\\') || (n + 1 == text.size()))
+        {
+            bytes += text[n];
+            continue;
+        }
+
+        char c = text[++n];
+        if (c == 'n')
+            bytes += '\n';
+        else if (c == 'r')
+            bytes += '\r';
+        else if (c == 't')
+            bytes += '\t';
+        else if ((c == 'x') && (n + 1 < text.size()) && isxdigit((unsigned char) text[n + 1]))
+        {
+            size_t digits = (n + 2 < text.size() && isxdigit((unsigned char) text[n + 2])) ? 2 : 1;
+            bytes += (char) strtoul(text.substr(n + 1, digits).c_str(), nullptr, 16);
+            n += digits;
+        }
+        else
+            bytes += c;
+    }
+    return bytes;
+}
+
+bool parse_args(int argc, char** argv)
+{
+    bool help = false;
+
+    std::string argument_to_parse = "";
+    for(int a = 1; a < argc; a++)
+    {
+        std::string arg = argv[a];
+        if (argument_to_parse == "")
+        {
+            if ((arg == "-p") || (arg == "--listen-port"))
+            {
+                argument_to_parse = "listen-port";
+            }
+            else if ((arg == "-d") || (arg == "--destination-port"))
+            {
+                argument_to_parse = "destination-port";
+            }
+            else if ((arg == "-a") || (arg == "--destination-addr"))
+            {
+                argument_to_parse = "destination-addr";
+            }
+            else if ((arg == "-l") || (arg == "--listen-addr"))
+            {
+                argument_to_parse = "listen-addr";
+            }
+            else if ((arg == "-w") || (arg == "--report-width"))
+            {
+                argument_to_parse = "report-width";
+            }
+            else if ((arg == "-r") || (arg == "--report-repeats"))
+            {
+                argument_to_parse = "report-repeats";
+            }
+            else if ((arg == "-s") || (arg == "--max-sessions"))
+            {
+                argument_to_parse = "max-sessions";
+            }
+            else if ((arg == "-q") || (arg == "--no-dump"))
+            {
+                dump_data = false;
+            }
+            else if ((arg == "-c") || (arg == "--no-splice"))
+            {
+                use_splice = false;
+            }
+            else if ((arg == "-b") || (arg == "--read-buffer"))
+            {
+                argument_to_parse = "read-buffer";
+            }
+            else if ((arg == "-g") || (arg == "--io-budget"))
+            {
+                argument_to_parse = "io-budget";
+            }
+            else if ((arg == "-H") || (arg == "--high-watermark"))
+            {
+                argument_to_parse = "high-watermark";
+            }
+            else if ((arg == "-L") || (arg == "--low-watermark"))
+            {
+                argument_to_parse = "low-watermark";
+            }
+            else if ((arg == "-e") || (arg == "--reactor"))
+            {
+                argument_to_parse = "reactor";
+            }
+            else if ((arg == "-B") || (arg == "--balance"))
+            {
+                argument_to_parse = "balance";
+            }
+            else if ((arg == "-Q") || (arg == "--log-queue"))
+            {
+                argument_to_parse = "log-queue";
+            }
+            else if ((arg == "-D") || (arg == "--log-drop"))
+            {
+                log_drop = true;
+            }
+            else if ((arg == "-T") || (arg == "--threads"))
+            {
+                argument_to_parse = "threads";
+            }
+            else if ((arg == "-A") || (arg == "--pin-threads"))
+            {
+                pin_workers = true;
+            }
+            else if ((arg == "-m") || (arg == "--pool-min"))
+            {
+                argument_to_parse = "pool-min";
+            }
+            else if ((arg == "-M") || (arg == "--pool-max"))
+            {
+                argument_to_parse = "pool-max";
+            }
+            else if ((arg == "-I") || (arg == "--pool-idle-timeout"))
+            {
+                argument_to_parse = "pool-idle-timeout";
+            }
+            else if ((arg == "-C") || (arg == "--connect-timeout"))
+            {
+                argument_to_parse = "connect-timeout";
+            }
+            else if ((arg == "-W") || (arg == "--idle-timeout"))
+            {
+                argument_to_parse = "idle-timeout";
+            }
+            else if ((arg == "-X") || (arg == "--max-lifetime"))
+            {
+                argument_to_parse = "max-lifetime";
+            }
+            else if ((arg == "-u") || (arg == "--tcp-profile"))
+            {
+                argument_to_parse = "tcp-profile";
+            }
+            else if ((arg == "-j") || (arg == "--socket-buffer"))
+            {
+                argument_to_parse = "socket-buffer";
+            }
+            else if ((arg == "-J") || (arg == "--defer-accept"))
+            {
+                argument_to_parse = "defer-accept";
+            }
+            else if ((arg == "-U") || (arg == "--fast-open"))
+            {
+                argument_to_parse = "fast-open";
+            }
+            else if ((arg == "-z") || (arg == "--backlog"))
+            {
+                argument_to_parse = "backlog";
+            }
+            else if ((arg == "-o") || (arg == "--dns-ttl"))
+            {
+                argument_to_parse = "dns-ttl";
+            }
+            else if ((arg == "-E") || (arg == "--dns-retry"))
+            {
+                argument_to_parse = "dns-retry";
+            }
+            else if ((arg == "-f") || (arg == "--capture-file"))
+            {
+                argument_to_parse = "capture-file";
+            }
+#ifndef _WIN32
+            else if ((arg == "-S") || (arg == "--segment-file"))
+            {
+                argument_to_parse = "segment-file";
+            }
+            else if ((arg == "-Z") || (arg == "--segment-size"))
+            {
+                argument_to_parse = "segment-size";
+            }
+            else if ((arg == "-Y") || (arg == "--segment-seconds"))
+            {
+                argument_to_parse = "segment-seconds";
+            }
+            else if ((arg == "-k") || (arg == "--segment-keep"))
+            {
+                argument_to_parse = "segment-keep";
+            }
+#endif
+            else if ((arg == "-P") || (arg == "--metrics-port"))
+            {
+                argument_to_parse = "metrics-port";
+            }
+            else if ((arg == "-F") || (arg == "--frame"))
+            {
+                argument_to_parse = "frame";
+            }
+            else if ((arg == "-G") || (arg == "--grep"))
+            {
+                argument_to_parse = "grep";
+            }
+            else if ((arg == "-O") || (arg == "--headers-only"))
+            {
+                log_headers_only = true;
+            }
+            else if ((arg == "-N") || (arg == "--log-limit"))
+            {
+                argument_to_parse = "log-limit";
+            }
+            else if ((arg == "-K") || (arg == "--log-sample"))
+            {
+                argument_to_parse = "log-sample";
+            }
+            else if ((arg == "-R") || (arg == "--log-rate"))
+            {
+                argument_to_parse = "log-rate";
+            }
+            else if ((arg == "-t") || (arg == "--report-time"))
+            {
+                report_time = true;
+            }
+            else if ((arg == "-i") || (arg == "--report-ip"))
+            {
+                report_ip = true;
+            }
+            else if ((arg == "-n") || (arg == "--report-port"))
+            {
+                report_port = true;
+            }
+            else if ((arg == "-v") || (arg == "--verbose"))
+            {
+                verbose = true;
+                report_ip = true;
+                report_port = true;
+                report_time = true;
+            }
+            else if ((arg == "-?") || (arg == "--help"))
+            {
+                help = true;
+            }
+            else
+            {
+                break;
+                help = true;
+            }
+        }
+        else
+        {
+            if (argument_to_parse == "listen-port")
+            {
+                listen_port = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "destination-port")
+            {
+                connect_port = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "destination-addr")
+            {
+                connect_addresses.push_back(arg); // checked in main, with the port
+            }
+            else if (argument_to_parse == "listen-addr")
+            {
+                listen_address = arg; //todo: validation?
+            }
+            else if (argument_to_parse == "report-width")
+            {
+                report_width = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "report-repeats")
+            {
+                report_repeats = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "max-sessions")
+            {
+                max_sessions = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "read-buffer")
+            {
+                read_buffer_size = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "io-budget")
+            {
+                io_budget = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "high-watermark")
+            {
+                high_watermark = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "low-watermark")
+            {
+                low_watermark = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "threads")
+            {
+                worker_threads = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "pool-min")
+            {
+                pool_min_idle = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "pool-max")
+            {
+                pool_max_idle = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "pool-idle-timeout")
+            {
+                pool_idle_timeout = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "connect-timeout")
+            {
+                connect_timeout = std::max(atoi(arg.c_str()), 0);
+            }
+            else if (argument_to_parse == "idle-timeout")
+            {
+                idle_timeout = std::max(atoi(arg.c_str()), 0);
+            }
+            else if (argument_to_parse == "max-lifetime")
+            {
+                session_lifetime = std::max(atoi(arg.c_str()), 0);
+            }
+            else if (argument_to_parse == "tcp-profile")
+            {
+                tcp_profile = arg;
+                if ((tcp_profile != "default") && (tcp_profile != "latency") && (tcp_profile != "throughput"))
+                {
+                    help = true;
+                    std::cerr << "unknown tcp profile: " << arg << std::endl;
+                }
+            }
+            else if (argument_to_parse == "socket-buffer")
+            {
+                tcp_tuning.buffer_bytes = std::max(atoi(arg.c_str()), 0) * 1024;
+            }
+            else if (argument_to_parse == "defer-accept")
+            {
+                tcp_tuning.defer_accept = std::max(atoi(arg.c_str()), 0);
+            }
+            else if (argument_to_parse == "fast-open")
+            {
+                tcp_tuning.fast_open = std::max(atoi(arg.c_str()), 0);
+            }
+            else if (argument_to_parse == "backlog")
+            {
+                tcp_tuning.backlog = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "dns-ttl")
+            {
+                dns_ttl = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "dns-retry")
+            {
+                dns_retry = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "capture-file")
+            {
+                capture_file = arg;
+            }
+            else if (argument_to_parse == "segment-file")
+            {
+                segment_file = arg;
+            }
+            else if (argument_to_parse == "segment-size")
+            {
+                segment_size = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "segment-seconds")
+            {
+                segment_seconds = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "segment-keep")
+            {
+                segment_keep = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "metrics-port")
+            {
+                metrics_port = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "frame")
+            {
+                frame_spec = arg;
+                if (make_decoder(frame_spec) == nullptr)
+                {
+                    help = true;
+                    std::cerr << "unknown framing: " << arg << std::endl;
+                }
+            }
+            else if (argument_to_parse == "grep")
+            {
+                log_pattern = unescape(arg);
+            }
+            else if (argument_to_parse == "log-limit")
+            {
+                log_limit = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "log-sample")
+            {
+                log_sample = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "log-rate")
+            {
+                log_rate = atoi(arg.c_str());
+            }
+            else if (argument_to_parse == "log-queue")
+            {
+                log_queue_size = std::max(atoi(arg.c_str()), 1);
+            }
+            else if (argument_to_parse == "reactor")
+            {
+                reactor_backend = arg;
+                if (make_reactor(reactor_backend) == nullptr)
+                {
+                    help = true;
+                    std::cerr << "unknown reactor, or not available here: " << arg << std::endl;
+                }
+            }
+            else if (argument_to_parse == "balance")
+            {
+                balance_policy = arg;
+                if (backend_set::parse_policy(balance_policy) < 0)
+                {
+                    help = true;
+                    std::cerr << "unknown balance policy: " << arg << std::endl;
+                }
+            }
+            else
+            {
+                help = true;
+                std::cerr << "internal error" << std::endl;
+            }
+            argument_to_parse = "";
+        }
+    }
+
+    if (high_watermark > 0)
+        low_watermark = std::min(low_watermark, high_watermark);
+
+    // a profile only fills in what wasn't asked for on its own
+    if (tcp_profile == "latency")
+    {
+        tcp_tuning.no_delay = true;
+        tcp_tuning.quick_ack = true;
+    }
+    else if ((tcp_profile == "throughput") && (tcp_tuning.buffer_bytes == 0))
+    {
+        tcp_tuning.buffer_bytes = 4 << 20;
+    }
+
+#ifndef SO_REUSEPORT
+    if (worker_threads > 1)
+    {
+        std::cerr << "more than one thread needs SO_REUSEPORT, running with one" << std::endl;
+        worker_threads = 1;
+    }
+#endif
+
+    if (argument_to_parse != "")
+    {
+        std::cerr << "expected argument for " << argument_to_parse << std::endl;
+    }
+
+    if (help)
+    {
+        std::cerr << "usage: " << std::endl;
+        std::cerr << "\tnosey [options]" << std::endl << std::endl;
+        std::cerr << "option listing:" << std::endl;
+        std::cerr << "\t-l/--listen-addr, " << listen_address << std::endl;
+        std::cerr << "\t-p/--listen-port, " << listen_port << std::endl;
+        std::cerr << "\t-a/--destination-addr, " << connect_address << " (host or host:port, repeat for several backends)" << std::endl;
+        std::cerr << "\t-d/--destination-port, " << connect_port << " (for destinations without one)" << std::endl;
+        std::cerr << "\t-o/--dns-ttl, " << dns_ttl << " (seconds a destination's looked up address is kept at most)" << std::endl;
+        std::cerr << "\t-E/--dns-retry, " << dns_retry << " (seconds before a failed lookup is tried again)" << std::endl;
+        std::cerr << "\t-B/--balance, " << balance_policy << " (round-robin, least-conn or hash on the client address)" << std::endl;
+        std::cerr << "\t-w/--report-width, " << report_width << std::endl;
+        std::cerr << "\t-r/--report-repeats, " << report_repeats << std::endl;
+        std::cerr << "\t-s/--max-sessions, " << max_sessions << " (0 for no limit)" << std::endl;
+        std::cerr << "\t-T/--threads, " << worker_threads << " (event loops, each with its own listening socket)" << std::endl;
+        std::cerr << "\t-A/--pin-threads, keep each event loop on one cpu" << std::endl;
+        std::cerr << "\t-m/--pool-min, " << pool_min_idle << " (upstream connections kept ready per thread, 0 for none)" << std::endl;
+        std::cerr << "\t-M/--pool-max, " << pool_max_idle << std::endl;
+        std::cerr << "\t-I/--pool-idle-timeout, " << pool_idle_timeout << " (seconds)" << std::endl;
+        std::cerr << "\t-C/--connect-timeout, " << connect_timeout << " (seconds, 0 to leave it to the system)" << std::endl;
+        std::cerr << "\t-W/--idle-timeout, " << idle_timeout << " (seconds without reading either way, 0 for no limit)" << std::endl;
+        std::cerr << "\t-X/--max-lifetime, " << session_lifetime << " (seconds, 0 for no limit)" << std::endl;
+        std::cerr << "\t-u/--tcp-profile, " << tcp_profile << " (default, latency: TCP_NODELAY and TCP_QUICKACK, throughput: 4 MB socket buffers)" << std::endl;
+        std::cerr << "\t-j/--socket-buffer, " << tcp_tuning.buffer_bytes / 1024 << " (SO_RCVBUF and SO_SNDBUF in KB, 0 for the system's own)" << std::endl;
+#ifdef __linux__
+        std::cerr << "\t-J/--defer-accept, " << tcp_tuning.defer_accept << " (seconds to wait for a client's first bytes before accepting, 0 for off)" << std::endl;
+        std::cerr << "\t-U/--fast-open, " << tcp_tuning.fast_open << " (TCP Fast Open queue on the listener, 0 for off)" << std::endl;
+#endif
+        std::cerr << "\t-z/--backlog, " << tcp_tuning.backlog << " (listen backlog)" << std::endl;
+#if defined(NOSEY_IO_URING)
+        std::cerr << "\t-e/--reactor, " << reactor_backend << " (epoll, uring or poll)" << std::endl;
+#elif defined(__linux__)
+        std::cerr << "\t-e/--reactor, " << reactor_backend << " (epoll or poll)" << std::endl;
+#else
+        std::cerr << "\t-e/--reactor, " << reactor_backend << std::endl;
+#endif
+        std::cerr << "\t-t/--report-time" << std::endl;
+        std::cerr << "\t-i/--report-ip" << std::endl;
+        std::cerr << "\t-n/--report-port" << std::endl;
+        std::cerr << "\t-q/--no-dump" << std::endl;
+#ifdef __linux__
+        std::cerr << "\t-c/--no-splice, copy through user space even with --no-dump" << std::endl;
+#endif
+        std::cerr << "\t-b/--read-buffer, " << read_buffer_size << std::endl;
+        std::cerr << "\t-g/--io-budget, " << io_budget << " (bytes per connection per turn)" << std::endl;
+        std::cerr << "\t-H/--high-watermark, " << high_watermark << " (queued bytes, 0 for no limit)" << std::endl;
+        std::cerr << "\t-L/--low-watermark, " << low_watermark << std::endl;
+        std::cerr << "\t-Q/--log-queue, " << log_queue_size << " (records)" << std::endl;
+        std::cerr << "\t-D/--log-drop, drop log records rather than wait when the queue is full" << std::endl;
+        std::cerr << "\t-f/--capture-file, write relayed data to this pcapng file instead of a hex dump" << std::endl;
+#ifndef _WIN32
+        std::cerr << "\t-S/--segment-file, write relayed data to rotating segment files with this base name instead of a hex dump" << std::endl;
+        std::cerr << "\t-Z/--segment-size, " << segment_size << " (megabytes)" << std::endl;
+        std::cerr << "\t-Y/--segment-seconds, " << segment_seconds << " (rotate after this long too, 0 for size only)" << std::endl;
+        std::cerr << "\t-k/--segment-keep, " << segment_keep << " (segment files left on disk)" << std::endl;
+#endif
+        std::cerr << "\t-F/--frame, " << frame_spec << " (split the dump into messages: none, line, delim:<byte or 0xNN>, length:<1|2|4|8>[:le], http)" << std::endl;
+        std::cerr << "\t-G/--grep, only dump messages containing these bytes (\\xNN, \\r, \\n, \\t and \\\\ escapes)" << std::endl;
+        std::cerr << "\t-O/--headers-only, dump the header of each message, not its body" << std::endl;
+        std::cerr << "\t-N/--log-limit, " << log_limit << " (bytes logged from each direction of a session, 0 for all)" << std::endl;
+        std::cerr << "\t-K/--log-sample, " << log_sample << " (log one session in this many)" << std::endl;
+        std::cerr << "\t-R/--log-rate, " << log_rate << " (bytes logged per second across all sessions, 0 for no cap)" << std::endl;
+        std::cerr << "\t-P/--metrics-port, " << metrics_port << " (serve prometheus metrics on 127.0.0.1, 0 for none)" << std::endl;
+        std::cerr << "\t-v/--verbose" << std::endl;
+        std::cerr << "\t-?/--help" << std::endl;
+        std::cerr << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// host or host:port, the port defaulting to connect_port; host is left empty for an address
+bool parse_destination(const std::string& text, sockaddr_in& addr, std::string& host)
+{
+    std::string name = text;
+    int port = connect_port;
+    size_t colon = text.find(':');
+    if (colon != std::string::npos)
+    {
+        name = text.substr(0, colon);
+        port = atoi(text.c_str() + colon + 1);
+        if ((port <= 0) || (port > 65535))
+            return false;
+    }
+
+    addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u_short) port);
+#ifdef _WIN32
+    bool numeric = InetPtonA(AF_INET, name.c_str(), &addr.sin_addr) == 1;
+#else
+    bool numeric = inet_aton(name.c_str(), &addr.sin_addr) != 0;
+#endif
+    host = numeric ? std::string() : name;
+    return !name.empty();
+}
+
+int main(int argc, char** argv) 
+{
+    if (!parse_args(argc, argv))
+    {
+        return -1;
+    }
+
+    signal(SIGINT, request_stop);
+
+#ifdef _WIN32
+    WORD wVersionRequested;
+    WSADATA wsaData;
+    wVersionRequested = MAKEWORD(2, 2);
+
+    int err = WSAStartup(wVersionRequested, &wsaData);
+    if (err != 0) {
+        printf("WSAStartup failed with error: %d\n", err);
+        return 1;
+    }
+#else
+    signal(SIGPIPE, SIG_IGN); // a peer resetting one session must not kill the rest
+    signal(SIGTERM, request_stop);
+
+    // every session holds two descriptors
+    rlimit files = {0};
+    if ((getrlimit(RLIMIT_NOFILE, &files) == 0) && (files.rlim_cur < files.rlim_max))
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+#endif
+
+    sockaddr_in listen_addr = { 0 };
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_port = htons(listen_port);
+
+#ifdef _WIN32
+    int r = InetPtonA(AF_INET, listen_address.c_str(), &listen_addr.sin_addr);
+#else
+    int r = inet_aton(listen_address.c_str(), &listen_addr.sin_addr);
+#endif
+
+    if (r == 0)
+        std::cerr << "invalid address: " << listen_address << std::endl;
+
+    if (connect_addresses.empty())
+        connect_addresses.push_back(connect_address);
+    for (auto& destination : connect_addresses)
+    {
+        sockaddr_in connect_addr = { 0 };
+        std::string host;
+        if (!parse_destination(destination, connect_addr, host))
+            std::cerr << "invalid address: " << destination << std::endl;
+        else if (host.empty())
+            backends.add(connect_addr);
+        else
+            backends.add(connect_addr, host_names.add(host));
+    }
+    if (backends.size() == 0)
+        return -1;
+
+    // the first lookups happen here, later ones on threads of their own and never on an event loop
+    if (!host_names.start(std::chrono::seconds(dns_ttl), std::chrono::seconds(dns_retry), 4))
+    {
+        for (size_t n = 0; n < host_names.size(); n++)
+        {
+            if (host_names.at(n).ip == 0)
+                std::cerr << "could not resolve " << host_names.at(n).host << ", trying again every " << dns_retry << " seconds" << std::endl;
+        }
+    }
+    backends.set_policy(backend_set::parse_policy(balance_policy));
+
+    if (!capture_file.empty() && !logger.open_capture(capture_file))
+    {
+        std::cerr << "could not open capture file: " << capture_file << std::endl;
+        return -1;
+    }
+#ifndef _WIN32
+    if (!segment_file.empty() && !logger.open_segments(segment_file, segment_size << 20, segment_seconds, segment_keep))
+    {
+        std::cerr << "could not open segment file: " << segment_name(segment_file, 1) << std::endl;
+        return -1;
+    }
+#endif
+    // received data needs the full queue; without a dump or capture file only events go through it,
+    // a few short records per session, so it isn't worth megabytes of records
+    bool logging_data = dump_data || !capture_file.empty();
+    logger.start(logging_data ? log_queue_size : std::min(log_queue_size, event_queue_size), !log_drop);
+
+    if (verbose)
+    {
+        for (size_t n = 0; n < backends.size(); n++)
+            logger.line("configured far end: " + backends.at(n).name);
+    }
+
+    logger.event(listen_addr, true, " listening");
+    std::vector<SOCKET> listeners;
+    for (int n = 0; n < worker_threads; n++)
+    {
+        SOCKET fd = open_listener(listen_addr, worker_threads > 1);
+        if (fd == INVALID_SOCKET)
+            break;
+        listeners.push_back(fd);
+    }
+
+    bool metrics_ready = true;
+    if (metrics_port > 0)
+    {
+        sockaddr_in metrics_addr = { 0 };
+        metrics_addr.sin_family = AF_INET;
+        metrics_addr.sin_port = htons(metrics_port);
+        metrics_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        metrics_listener = open_listener(metrics_addr, false);
+        metrics_ready = (metrics_listener != INVALID_SOCKET);
+        if (metrics_ready)
+            logger.event(metrics_addr, true, " serving metrics");
+    }
+
+    for (int n = 0; n < worker_threads; n++)
+        worker_stats.emplace_back(new worker_metrics());
+
+    if ((listeners.size() == (size_t) worker_threads) && metrics_ready)
+    {
+        // every worker has its own event loop, and a session stays on the worker that accepted it
+        std::vector<std::thread> workers;
+        for (int n = 1; n < worker_threads; n++)
+            workers.emplace_back(run_worker, n, listeners[n]);
+
+        run_worker(0, listeners[0]);
+        for (auto& worker : workers)
+            worker.join();
+
+        host_names.stop();
+        logger.stop();
+        print_totals();
+        if ((log_limit > 0) || (log_sample > 1) || (log_rate > 0))
+            print_log_skipped();
+    }
+
+    for (auto fd : listeners)
+        cleanup_socket(fd);
+    if (metrics_listener != INVALID_SOCKET)
+        cleanup_socket(metrics_listener);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1301 @@
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <random>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+#include "connection.h"
+#include "hex_dump.h"
+
+// connection.h leaves its tuning to the program, these are nosey's defaults
+size_t read_buffer_size = 1 << 16;
+size_t io_budget = 1 << 20;
+size_t high_watermark = 1 << 20;
+size_t low_watermark = 1 << 18;
+socket_tuning tcp_tuning = { false, false, 0, 0, 0, SOMAXCONN };
+
+typedef std::chrono::steady_clock bench_clock;
+
+double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// the rate column is MB/s unless a unit says otherwise (1e9 for GB/s)
+void report(const std::string& name, const std::string& variant, size_t count, size_t bytes, double seconds, double unit = 1e6)
+{
+    std::cout << name << "\t" << variant << "\t" << count << "\t" << bytes << "\t"
+        << std::fixed << std::setprecision(3) << seconds << "\t"
+        << std::setprecision(unit > 1e6 ? 3 : 1) << (bytes / seconds / unit) << std::endl;
+}
+
+// the write queue connection used to keep: one byte per push_back, drained 256 bytes per send
+class deque_queue
+{
+    std::deque<uint8_t> queue_;
+
+public:
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+
+    void append(const uint8_t* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+            queue_.push_back(data[i]);
+    }
+
+    template <typename sink>
+    size_t drain(sink& s)
+    {
+        uint8_t io_buffer[256];
+        size_t n = 0;
+        for (n = 0; n < queue_.size() && n < sizeof(io_buffer); n++)
+            io_buffer[n] = queue_[n];
+
+        long ns = s.write(io_buffer, n);
+        if (ns > 0)
+            queue_.erase(queue_.begin(), queue_.begin() + ns);
+        return ns > 0 ? ns : 0;
+    }
+};
+
+class ring_queue
+{
+    write_queue queue_;
+
+public:
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+
+    void append(const uint8_t* data, size_t length)
+    {
+        queue_.append(data, length);
+    }
+
+    template <typename sink>
+    size_t drain(sink& s)
+    {
+        iovec buffers[write_queue::max_gather];
+        size_t count = queue_.gather(buffers, write_queue::max_gather);
+        long ns = s.writev(buffers, count);
+        if (ns > 0)
+            queue_.consume(ns);
+        return ns > 0 ? ns : 0;
+    }
+};
+
+// stands in for the kernel copy, so only the queue itself is measured
+class memory_sink
+{
+    std::vector<uint8_t> buffer_;
+
+public:
+    memory_sink() : buffer_(1 << 20) {}
+
+    long write(const uint8_t* data, size_t length)
+    {
+        length = std::min(length, buffer_.size());
+        memcpy(buffer_.data(), data, length);
+        return (long) length;
+    }
+
+    long writev(const iovec* buffers, size_t count)
+    {
+        long total = 0;
+        for (size_t n = 0; n < count; n++)
+            total += write((const uint8_t*) buffers[n].iov_base, buffers[n].iov_len);
+        return total;
+    }
+
+    void settle()
+    {
+    }
+};
+
+// a nonblocking socketpair, so the syscall count per byte shows up as well
+class socket_sink
+{
+    int fds_[2];
+    std::vector<uint8_t> buffer_;
+
+public:
+    socket_sink() : buffer_(1 << 20)
+    {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds_);
+        fcntl(fds_[0], F_SETFL, fcntl(fds_[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds_[1], F_SETFL, fcntl(fds_[1], F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    ~socket_sink()
+    {
+        close(fds_[0]);
+        close(fds_[1]);
+    }
+
+    long write(const uint8_t* data, size_t length)
+    {
+        return ::send(fds_[0], data, length, MSG_NOSIGNAL);
+    }
+
+    long writev(const iovec* buffers, size_t count)
+    {
+        msghdr message = {0};
+        message.msg_iov = (iovec*) buffers;
+        message.msg_iovlen = count;
+        return sendmsg(fds_[0], &message, MSG_NOSIGNAL);
+    }
+
+    // the far end reads whatever arrived, freeing socket buffer for the next flush
+    void settle()
+    {
+        while (read(fds_[1], buffer_.data(), buffer_.size()) > 0)
+        {
+        }
+    }
+};
+
+template <typename queue, typename sink>
+double run_queue(size_t transfer, size_t total)
+{
+    std::vector<uint8_t> payload(transfer, 0x5a);
+    const size_t piece = 4096; // what a relay appends per receive
+
+    queue q;
+    sink s;
+    auto start = bench_clock::now();
+    for (size_t moved = 0; moved < total; moved += transfer)
+    {
+        for (size_t offs = 0; offs < transfer; offs += piece)
+            q.append(payload.data() + offs, std::min(piece, transfer - offs));
+
+        while (!q.empty())
+        {
+            if (q.drain(s) == 0)
+                s.settle();
+        }
+        s.settle();
+    }
+    return seconds_since(start);
+}
+
+int bench_queue(int argc, char** argv)
+{
+    size_t total = 16 << 20;
+    if (argc > 0)
+        total = strtoull(argv[0], nullptr, 10) << 20;
+
+    std::cout << "bench\tvariant\ttransfer\tbytes\tseconds\tMB/s" << std::endl;
+    for (size_t transfer : { (size_t) 1 << 10, (size_t) 64 << 10, (size_t) 1 << 20 })
+    {
+        size_t bytes = (total / transfer) * transfer;
+        report("queue-memory", "deque", transfer, bytes, run_queue<deque_queue, memory_sink>(transfer, bytes));
+        report("queue-memory", "ring", transfer, bytes, run_queue<ring_queue, memory_sink>(transfer, bytes));
+        report("queue-socket", "deque", transfer, bytes, run_queue<deque_queue, socket_sink>(transfer, bytes));
+        report("queue-socket", "ring", transfer, bytes, run_queue<ring_queue, socket_sink>(transfer, bytes));
+    }
+    return 0;
+}
+
+// how nosey formatted its hex dump through iostream, kept as the reference output and the baseline
+void iostream_dump(
+    std::ostream& out,
+    const std::string& line_pref,
+    int word_width,
+    int repeats,
+    const uint8_t* data,
+    int length
+)
+{
+    for (int line_offs = 0; line_offs < length; line_offs += word_width * repeats)
+    {
+        out << line_pref;
+        for (int r = 0; r < repeats; r++)
+        {
+            int repeat_offs = line_offs + r * word_width;
+            if (repeat_offs >= length)
+                break;
+
+            out << " ";
+            for (int n = 0; n < word_width; n++)
+            {
+                if (repeat_offs + n >= length)
+                    out << "  ";
+                else
+                    out << std::hex << std::setw(2) << std::setfill('0') << (int) data[repeat_offs + n];
+            }
+
+            out << " ";
+            for (int n = 0; (n < word_width) && (repeat_offs + n < length); n++)
+            {
+                char c = (char) data[repeat_offs + n];
+                if (c >= 0x20 && c < 0xFF)
+                    out << c;
+                else
+                    out << ".";
+            }
+        }
+        out << "\n";
+    }
+}
+
+const char* hex_kernel_name(int kernel)
+{
+    switch (kernel)
+    {
+    case hex_kernel_scalar: return "table";
+    case hex_kernel_sse2: return "sse2";
+    case hex_kernel_avx2: return "avx2";
+    }
+    return "?";
+}
+
+// format the same bytes in log writer sized records, checking every kernel against iostream first
+int bench_hexdump(int argc, char** argv)
+{
+    size_t total = 64 << 20;
+    if (argc > 0)
+        total = strtoull(argv[0], nullptr, 10) << 20;
+
+    const size_t record = 4096;
+    const std::string prefix = "2019-07-14 14:21:02+1200>127.0.0.1:50004";
+    std::vector<uint8_t> payload(1 << 20);
+    std::mt19937 random(42);
+    for (auto& b : payload)
+        b = (uint8_t) random();
+
+    std::vector<int> kernels;
+    for (int kernel : { hex_kernel_scalar, hex_kernel_sse2, hex_kernel_avx2 })
+    {
+        if (hex_resolve_kernel(kernel) == kernel)
+            kernels.push_back(kernel);
+    }
+
+    std::cout << "bench\tvariant\tlayout\tbytes\tseconds\tGB/s" << std::endl;
+    for (auto layout : { std::make_pair(8, 3), std::make_pair(16, 1), std::make_pair(16, 2), std::make_pair(5, 7) })
+    {
+        int width = layout.first;
+        int repeats = layout.second;
+        std::string name = "hexdump-" + std::to_string(width) + "x" + std::to_string(repeats);
+
+        for (int kernel : kernels)
+        {
+            hex_dumper dumper(kernel);
+            for (size_t length : { (size_t) 1, (size_t) 15, (size_t) 33, (size_t) 100, (size_t) 4095, payload.size() })
+            {
+                std::ostringstream expected;
+                iostream_dump(expected, prefix, width, repeats, payload.data(), (int) length);
+                std::string actual;
+                dumper.format(actual, prefix.data(), prefix.size(), width, repeats, payload.data(), length);
+                if (actual != expected.str())
+                {
+                    std::cerr << hex_kernel_name(kernel) << " differs from iostream for " << length << " bytes in " << name << std::endl;
+                    return 1;
+                }
+            }
+        }
+
+        size_t iostream_total = std::min(total, (size_t) 8 << 20);
+        std::ostringstream sink;
+        auto start = bench_clock::now();
+        for (size_t offs = 0; offs < iostream_total; offs += record)
+        {
+            iostream_dump(sink, prefix, width, repeats, payload.data() + (offs % payload.size()), (int) record);
+            if (sink.tellp() > (1 << 20))
+                sink.str("");
+        }
+        report(name, "iostream", width * repeats, iostream_total, seconds_since(start), 1e9);
+
+        for (int kernel : kernels)
+        {
+            hex_dumper dumper(kernel);
+            std::string out;
+            out.reserve(2 << 20);
+            start = bench_clock::now();
+            for (size_t offs = 0; offs < total; offs += record)
+            {
+                dumper.format(out, prefix.data(), prefix.size(), width, repeats, payload.data() + (offs % payload.size()), record);
+                if (out.size() > (1 << 20))
+                    out.clear();
+            }
+            report(name, hex_kernel_name(kernel), width * repeats, total, seconds_since(start), 1e9);
+        }
+    }
+    return 0;
+}
+
+sockaddr_in loopback(int port)
+{
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+// the backend: takes a fixed number of connections and reads each until the far end closes
+class sink_server
+{
+    int listener_;
+    std::vector<std::thread> readers_;
+    std::atomic<uint64_t> received_;
+
+public:
+    sink_server(int port, int connections) :
+        received_(0)
+    {
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = loopback(port);
+        if ((bind(listener_, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(listener_, SOMAXCONN) != 0))
+        {
+            std::cerr << "sink could not listen on " << port << std::endl;
+            exit(1);
+        }
+
+        for (int n = 0; n < connections; n++)
+        {
+            readers_.emplace_back([this]()
+            {
+                int fd = accept(listener_, nullptr, nullptr);
+                std::vector<uint8_t> buffer(1 << 16);
+                for (;;)
+                {
+                    ssize_t nr = read(fd, buffer.data(), buffer.size());
+                    if (nr <= 0)
+                        break;
+                    received_ += nr;
+                }
+                close(fd);
+            });
+        }
+    }
+
+    ~sink_server()
+    {
+        for (auto& t : readers_)
+            t.join();
+        close(listener_);
+    }
+
+    uint64_t received() const
+    {
+        return received_;
+    }
+};
+
+// seconds to push total bytes, split over some connections, through the proxy into a sink
+double run_throughput(int proxy_port, int sink_port, size_t total, int connections)
+{
+    size_t share = total / connections;
+    total = share * connections;
+
+    sink_server sink(sink_port, connections);
+    auto start = bench_clock::now();
+    {
+        std::vector<std::thread> senders;
+        for (int n = 0; n < connections; n++)
+        {
+            senders.emplace_back([proxy_port, share]()
+            {
+                int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                sockaddr_in addr = loopback(proxy_port);
+                if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+                {
+                    std::cerr << "could not connect to the proxy on " << proxy_port << std::endl;
+                    exit(1);
+                }
+
+                std::vector<uint8_t> payload(1 << 16, 0x5a);
+                for (size_t sent = 0; sent < share;)
+                {
+                    ssize_t ns = ::send(fd, payload.data(), std::min(payload.size(), share - sent), MSG_NOSIGNAL);
+                    if (ns <= 0)
+                        break;
+                    sent += ns;
+                }
+                close(fd);
+            });
+        }
+        for (auto& t : senders)
+            t.join();
+    }
+
+    while (sink.received() < total)
+    {
+        if (seconds_since(start) > 60)
+        {
+            std::cerr << "gave up waiting, the sink has " << sink.received() << " of " << total << " bytes" << std::endl;
+            exit(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return seconds_since(start);
+}
+
+// push bytes through a running nosey into a sink, nosey should be started as
+//   nosey -p <proxy port> -a 127.0.0.1 -d <sink port> [-q]
+int bench_throughput(int argc, char** argv)
+{
+    if (argc < 2)
+        return -1;
+
+    int proxy_port = atoi(argv[0]);
+    int sink_port = atoi(argv[1]);
+    size_t total = ((argc > 2) ? strtoull(argv[2], nullptr, 10) : 256) << 20;
+    int connections = (argc > 3) ? atoi(argv[3]) : 1;
+    std::string label = (argc > 4) ? argv[4] : "proxy";
+
+    total = (total / connections) * connections;
+    double seconds = run_throughput(proxy_port, sink_port, total, connections);
+
+    std::cout << "bench\tvariant\tconnections\tbytes\tseconds\tMB/s" << std::endl;
+    report("throughput", label, connections, total, seconds);
+    return 0;
+}
+
+// a backend that hangs up on every connection as soon as it has accepted it
+class closing_server
+{
+    int listener_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+public:
+    closing_server(int port) :
+        running_(true)
+    {
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = loopback(port);
+        if ((bind(listener_, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(listener_, SOMAXCONN) != 0))
+        {
+            std::cerr << "backend could not listen on " << port << std::endl;
+            exit(1);
+        }
+
+        thread_ = std::thread([this]()
+        {
+            while (running_)
+            {
+                int fd = accept(listener_, nullptr, nullptr);
+                if (fd >= 0)
+                    close(fd);
+            }
+        });
+    }
+
+    ~closing_server()
+    {
+        running_ = false;
+        shutdown(listener_, SHUT_RDWR); // wakes the accept
+        thread_.join();
+        close(listener_);
+    }
+};
+
+// whole sessions per second: connect through the proxy, which connects to a backend that hangs up,
+// and wait for the proxy to pass the hang up back
+double run_session_rate(int proxy_port, int backend_port, int clients, double seconds, size_t& sessions)
+{
+    closing_server backend(backend_port);
+    std::atomic<size_t> completed(0);
+    std::vector<std::thread> threads;
+    auto start = bench_clock::now();
+    for (int n = 0; n < clients; n++)
+    {
+        threads.emplace_back([&]()
+        {
+            while (seconds_since(start) < seconds)
+            {
+                int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                sockaddr_in addr = loopback(proxy_port);
+                if (connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0)
+                {
+                    char c;
+                    if (read(fd, &c, 1) == 0)
+                        completed++;
+                }
+                close(fd);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    sessions = completed;
+    return seconds_since(start);
+}
+
+// starts nosey listening on port with stdout thrown away, returns 0 if it never starts listening
+pid_t start_nosey(const std::string& nosey, int port, const std::vector<std::string>& arguments)
+{
+    pid_t child = fork();
+    if (child == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(null, 2);
+        std::vector<char*> argv;
+        argv.push_back((char*) nosey.c_str());
+        for (auto& a : arguments)
+            argv.push_back((char*) a.c_str());
+        argv.push_back(nullptr);
+        execv(nosey.c_str(), argv.data());
+        _exit(127);
+    }
+
+    for (int tries = 0; tries < 500; tries++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr = loopback(port);
+        bool up = connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+        close(fd);
+        if (up)
+            return child;
+        if (waitpid(child, nullptr, WNOHANG) == child)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+    return 0;
+}
+
+// stops it and returns the cpu seconds it used
+double stop_nosey(pid_t child)
+{
+    kill(child, SIGTERM);
+    int status = 0;
+    rusage usage = {};
+    wait4(child, &status, 0, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// runs nosey from 1 to N threads, measuring sessions per second and throughput at each
+int bench_scaling(int argc, char** argv)
+{
+    if (argc < 3)
+        return -1;
+
+    std::string nosey = argv[0];
+    int proxy_port = atoi(argv[1]);
+    int backend_port = atoi(argv[2]);
+    int max_threads = (argc > 3) ? atoi(argv[3]) : std::max((int) std::thread::hardware_concurrency(), 1);
+    size_t total = ((argc > 4) ? strtoull(argv[4], nullptr, 10) : 256) << 20;
+    int connections = (argc > 5) ? atoi(argv[5]) : 8;
+    total = (total / connections) * connections;
+
+    std::cout << "bench\tvariant\tthreads\tcount\tseconds\trate" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        // a fresh port each round, the last round's connections are still in TIME_WAIT on the old one
+        int port = proxy_port + threads - 1;
+        pid_t child = start_nosey(nosey, port, { "-p", std::to_string(port), "-a", "127.0.0.1", "-d", std::to_string(backend_port),
+            "-q", "-s", "0", "-T", std::to_string(threads), "-A" });
+        if (child == 0)
+        {
+            std::cerr << "nosey did not start listening on " << port << std::endl;
+            return 1;
+        }
+
+        size_t sessions = 0;
+        double seconds = run_session_rate(port, backend_port, connections, 2.0, sessions);
+        std::cout << "scaling\tsessions/s\t" << threads << "\t" << sessions << "\t"
+            << std::fixed << std::setprecision(3) << seconds << "\t"
+            << std::setprecision(0) << (sessions / seconds) << std::endl;
+
+        seconds = run_throughput(port, backend_port, total, connections);
+        std::cout << "scaling\tMB/s\t" << threads << "\t" << total << "\t"
+            << std::fixed << std::setprecision(3) << seconds << "\t"
+            << std::setprecision(1) << (total / seconds / 1e6) << std::endl;
+
+        stop_nosey(child);
+    }
+    return 0;
+}
+
+// the backend for echo: sends back whatever each connection sends, until it closes
+class echo_server
+{
+    int listener_;
+    std::thread acceptor_;
+    std::vector<std::thread> echoers_;
+    std::atomic<bool> running_;
+
+public:
+    echo_server(int port) :
+        running_(true)
+    {
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = loopback(port);
+        if ((bind(listener_, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(listener_, SOMAXCONN) != 0))
+        {
+            std::cerr << "echo server could not listen on " << port << std::endl;
+            exit(1);
+        }
+
+        acceptor_ = std::thread([this]()
+        {
+            while (running_)
+            {
+                int fd = accept(listener_, nullptr, nullptr);
+                if (fd < 0)
+                    continue;
+                echoers_.emplace_back([fd]()
+                {
+                    std::vector<uint8_t> buffer(1 << 16);
+                    for (;;)
+                    {
+                        ssize_t nr = read(fd, buffer.data(), buffer.size());
+                        if ((nr <= 0) || (::send(fd, buffer.data(), nr, MSG_NOSIGNAL) != nr))
+                            break;
+                    }
+                    close(fd);
+                });
+            }
+        });
+    }
+
+    // after the clients have gone, so every echoer sees its connection close
+    ~echo_server()
+    {
+        running_ = false;
+        shutdown(listener_, SHUT_RDWR);
+        acceptor_.join();
+        for (auto& t : echoers_)
+            t.join();
+        close(listener_);
+    }
+};
+
+// request/response through nosey with each reactor: every connection sends a message and waits for
+// the echo before sending the next, so the cost per event loop turn is what gets measured
+int bench_echo(int argc, char** argv)
+{
+    if (argc < 3)
+        return -1;
+
+    std::string nosey = argv[0];
+    int proxy_port = atoi(argv[1]);
+    int echo_port = atoi(argv[2]);
+    double duration = (argc > 3) ? atof(argv[3]) : 2.0;
+    int connections = (argc > 4) ? atoi(argv[4]) : 8;
+    size_t size = (argc > 5) ? strtoull(argv[5], nullptr, 10) : 64;
+    std::vector<std::string> backends = { "poll", "epoll", "uring" };
+    if (argc > 6)
+        backends.assign(argv + 6, argv + argc);
+
+    std::cout << "bench\tvariant\tround trips\tbytes\tseconds\tround trips/s\tMB/s\tnosey cpu us/round trip" << std::endl;
+    for (size_t b = 0; b < backends.size(); b++)
+    {
+        int port = proxy_port + (int) b;
+        pid_t child = start_nosey(nosey, port, { "-p", std::to_string(port), "-a", "127.0.0.1", "-d", std::to_string(echo_port),
+            "-q", "-c", "-e", backends[b] });
+        if (child == 0)
+        {
+            std::cerr << "skipping " << backends[b] << ", nosey would not start with it" << std::endl;
+            continue;
+        }
+
+        std::atomic<size_t> round_trips(0);
+        double seconds = 0;
+        {
+            echo_server echo(echo_port);
+            std::vector<std::thread> clients;
+            auto start = bench_clock::now();
+            for (int n = 0; n < connections; n++)
+            {
+                clients.emplace_back([&]()
+                {
+                    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                    sockaddr_in addr = loopback(port);
+                    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+                    {
+                        close(fd);
+                        return;
+                    }
+
+                    std::vector<uint8_t> message(size, 0x5a);
+                    std::vector<uint8_t> reply(size);
+                    while (seconds_since(start) < duration)
+                    {
+                        if (::send(fd, message.data(), size, MSG_NOSIGNAL) != (ssize_t) size)
+                            break;
+                        size_t got = 0;
+                        while (got < size)
+                        {
+                            ssize_t nr = read(fd, reply.data() + got, size - got);
+                            if (nr <= 0)
+                                break;
+                            got += nr;
+                        }
+                        if (got < size)
+                            break;
+                        round_trips++;
+                    }
+                    close(fd);
+                });
+            }
+            for (auto& t : clients)
+                t.join();
+            seconds = seconds_since(start);
+        }
+        double cpu = stop_nosey(child);
+
+        size_t count = round_trips;
+        std::cout << "echo\t" << backends[b] << "\t" << count << "\t" << count * size * 2 << "\t"
+            << std::fixed << std::setprecision(3) << seconds << "\t"
+            << std::setprecision(0) << (count / seconds) << "\t"
+            << std::setprecision(1) << (count * size * 2 / seconds / 1e6) << "\t"
+            << std::setprecision(2) << (count > 0 ? cpu * 1e6 / count : 0) << std::endl;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+const char* bench_reactor = "epoll";
+#else
+const char* bench_reactor = "poll";
+#endif
+
+// one connection of the load backend, sending back whatever it receives
+class echo_connection
+{
+    server_connection connection_;
+
+public:
+    echo_connection(reactor& r, std::vector<echo_connection*>& closed) :
+        connection_(
+            r,
+            []()
+            {
+            },
+            [this](const uint8_t* data, int length)
+            {
+                connection_.send(data, length, connection_.last_receive());
+                connection_.hold_back(&connection_);
+            },
+            [this, &closed]()
+            {
+                closed.push_back(this);
+            })
+    {
+    }
+
+    void accept(SOCKET fd)
+    {
+        connection_.accept(fd);
+    }
+};
+
+// the backend for load: an echo server on nosey's own event loop and server_connection
+class loop_echo_server : public io_handler
+{
+    std::unique_ptr<reactor> reactor_;
+    SOCKET listener_;
+    std::unordered_map<echo_connection*, std::unique_ptr<echo_connection>> connections_;
+    std::vector<echo_connection*> closed_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+
+public:
+    loop_echo_server(int port) :
+        reactor_(make_reactor(bench_reactor)),
+        running_(true)
+    {
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = loopback(port);
+        if ((bind(listener_, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(listener_, SOMAXCONN) != 0))
+        {
+            std::cerr << "echo server could not listen on " << port << std::endl;
+            exit(1);
+        }
+        set_nonblocking(listener_);
+        reactor_->add(listener_, this, io_readable);
+
+        thread_ = std::thread([this]()
+        {
+            while (running_)
+            {
+                reactor_->wait(10);
+                for (auto c : closed_)
+                    connections_.erase(c);
+                closed_.clear();
+            }
+        });
+    }
+
+    ~loop_echo_server()
+    {
+        running_ = false;
+        thread_.join();
+        connections_.clear();
+        reactor_->remove(listener_);
+        cleanup_socket(listener_);
+    }
+
+    void on_io(int events) override
+    {
+        for (;;)
+        {
+            SOCKET fd = accept_socket(listener_, nullptr);
+            if (fd == INVALID_SOCKET)
+                return;
+
+            std::unique_ptr<echo_connection> accepted(new echo_connection(*reactor_, closed_));
+            echo_connection* c = accepted.get();
+            connections_[c] = std::move(accepted);
+            c->accept(fd);
+        }
+    }
+};
+
+// what the clients of one load run saw, all on the one client event loop
+struct load_results
+{
+    std::vector<uint64_t> round_trip_ns;
+    std::vector<uint64_t> connect_ns;
+    size_t errors; // connects refused and sessions the proxy closed
+
+    // the q quantile in microseconds, samples sorted already
+    static double percentile(const std::vector<uint64_t>& samples, double q)
+    {
+        if (samples.empty())
+            return 0;
+        return samples[std::min(samples.size() - 1, (size_t) (q * samples.size()))] / 1e3;
+    }
+};
+
+// one client of load, on nosey's client_connection: sends a message, waits for all of it to come
+// back, sends it again, and reconnects after every so many requests when churn is asked for
+class load_client
+{
+    client_connection connection_;
+    sockaddr_in proxy_;
+    const std::vector<uint8_t>& message_;
+    size_t requests_per_connection_; // 0 keeps the connection
+    load_results& results_;
+    std::vector<load_client*>& reconnects_;
+    size_t received_;
+    size_t requests_;
+    bool queued_;
+    bench_clock::time_point connect_started_;
+    bench_clock::time_point sent_at_;
+
+    void send_next()
+    {
+        received_ = 0;
+        sent_at_ = bench_clock::now();
+        connection_.send(message_.data(), (int) message_.size());
+    }
+
+    // connections are only replaced between loop turns, never inside their own callbacks
+    void queue_reconnect()
+    {
+        if (!queued_)
+        {
+            queued_ = true;
+            reconnects_.push_back(this);
+        }
+    }
+
+public:
+    load_client(
+        reactor& r,
+        const sockaddr_in& proxy,
+        const std::vector<uint8_t>& message,
+        size_t requests_per_connection,
+        load_results& results,
+        std::vector<load_client*>& reconnects
+    ) :
+        connection_(
+            r,
+            [this]()
+            {
+                results_.connect_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - connect_started_).count());
+                send_next();
+            },
+            [this](const uint8_t* data, int length)
+            {
+                received_ += length;
+                if (received_ < message_.size())
+                    return;
+
+                results_.round_trip_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - sent_at_).count());
+                requests_++;
+                if ((requests_per_connection_ > 0) && (requests_ % requests_per_connection_ == 0))
+                    queue_reconnect();
+                else
+                    send_next();
+            },
+            [this]()
+            {
+                results_.errors++;
+                queue_reconnect();
+            }),
+        proxy_(proxy),
+        message_(message),
+        requests_per_connection_(requests_per_connection),
+        results_(results),
+        reconnects_(reconnects),
+        received_(0),
+        requests_(0),
+        queued_(false)
+    {
+    }
+
+    void connect()
+    {
+        queued_ = false;
+        connection_.disconnect();
+        connect_started_ = bench_clock::now();
+        connection_.connect(proxy_);
+    }
+};
+
+// request/response through nosey on the proxy's own connection classes, at each message size:
+// round trip percentiles, connection setup latency and throughput, one row per size
+int bench_load(int argc, char** argv)
+{
+    if (argc < 3)
+        return -1;
+
+    std::string nosey = argv[0];
+    int proxy_port = atoi(argv[1]);
+    int echo_port = atoi(argv[2]);
+    double duration = (argc > 3) ? atof(argv[3]) : 2.0;
+    int connections = (argc > 4) ? atoi(argv[4]) : 16;
+    std::vector<size_t> sizes;
+    std::stringstream size_list((argc > 5) ? argv[5] : "64,4096");
+    for (std::string size; std::getline(size_list, size, ',');)
+        sizes.push_back(std::max(strtoull(size.c_str(), nullptr, 10), 1ULL));
+    size_t requests_per_connection = (argc > 6) ? strtoull(argv[6], nullptr, 10) : 0;
+    std::vector<std::string> options(argv + std::min(argc, 7), argv + argc);
+
+    loop_echo_server echo(echo_port);
+    std::cout << "bench\tmessage bytes\trequests per connection\tconnections\tround trips\tbytes\tseconds\tround trips/s\tMB/s"
+        "\tp50 us\tp99 us\tp999 us\tconnects\tconnect p50 us\tconnect p99 us\terrors" << std::endl;
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+        int port = proxy_port + (int) s;
+        std::vector<std::string> arguments = { "-p", std::to_string(port), "-a", "127.0.0.1", "-d", std::to_string(echo_port), "-q", "-s", "0" };
+        arguments.insert(arguments.end(), options.begin(), options.end());
+        pid_t child = start_nosey(nosey, port, arguments);
+        if (child == 0)
+        {
+            std::cerr << "nosey did not start listening on " << port << std::endl;
+            return 1;
+        }
+
+        std::vector<uint8_t> message(sizes[s], 0x5a);
+        load_results results = {};
+        double seconds = 0;
+        {
+            std::unique_ptr<reactor> events = make_reactor(bench_reactor);
+            std::vector<load_client*> reconnects;
+            std::vector<std::unique_ptr<load_client>> clients;
+            for (int n = 0; n < connections; n++)
+            {
+                clients.emplace_back(new load_client(*events, loopback(port), message, requests_per_connection, results, reconnects));
+                clients.back()->connect();
+            }
+
+            auto start = bench_clock::now();
+            while (seconds_since(start) < duration)
+            {
+                events->wait(10);
+                std::vector<load_client*> due;
+                due.swap(reconnects);
+                for (auto client : due)
+                    client->connect();
+            }
+            seconds = seconds_since(start);
+        }
+        stop_nosey(child);
+
+        std::sort(results.round_trip_ns.begin(), results.round_trip_ns.end());
+        std::sort(results.connect_ns.begin(), results.connect_ns.end());
+        size_t count = results.round_trip_ns.size();
+        std::cout << "load\t" << sizes[s] << "\t" << requests_per_connection << "\t" << connections << "\t"
+            << count << "\t" << count * sizes[s] * 2 << "\t"
+            << std::fixed << std::setprecision(3) << seconds << "\t"
+            << std::setprecision(0) << (count / seconds) << "\t"
+            << std::setprecision(1) << (count * sizes[s] * 2 / seconds / 1e6) << "\t"
+            << load_results::percentile(results.round_trip_ns, 0.5) << "\t"
+            << load_results::percentile(results.round_trip_ns, 0.99) << "\t"
+            << load_results::percentile(results.round_trip_ns, 0.999) << "\t"
+            << results.connect_ns.size() << "\t"
+            << load_results::percentile(results.connect_ns, 0.5) << "\t"
+            << load_results::percentile(results.connect_ns, 0.99) << "\t"
+            << results.errors << std::endl;
+    }
+    return 0;
+}
+
+// connection churn: every client connects through nosey, makes one request and closes, over and over,
+// once relaying with splice and once copying through the write queues; what each session costs
+// nosey in cpu is the column to compare, the rate also depends on the clients sharing the machine
+int bench_churn(int argc, char** argv)
+{
+    if (argc < 3)
+        return -1;
+
+    std::string nosey = argv[0];
+    int proxy_port = atoi(argv[1]);
+    int echo_port = atoi(argv[2]);
+    double duration = (argc > 3) ? atof(argv[3]) : 2.0;
+    int connections = (argc > 4) ? atoi(argv[4]) : 16;
+    size_t size = (argc > 5) ? std::max(strtoull(argv[5], nullptr, 10), 1ULL) : 64;
+    std::vector<std::string> options(argv + std::min(argc, 6), argv + argc);
+
+    loop_echo_server echo(echo_port);
+    std::vector<uint8_t> message(size, 0x5a);
+    std::cout << "bench\tvariant\tsessions\tseconds\tsessions/s\tnosey cpu us/session\tconnect p50 us\tconnect p99 us\terrors" << std::endl;
+    for (int copy = 0; copy < 2; copy++)
+    {
+        int port = proxy_port + copy;
+        std::vector<std::string> arguments = { "-p", std::to_string(port), "-a", "127.0.0.1", "-d", std::to_string(echo_port), "-q", "-s", "0" };
+        if (copy)
+            arguments.push_back("-c");
+        arguments.insert(arguments.end(), options.begin(), options.end());
+        pid_t child = start_nosey(nosey, port, arguments);
+        if (child == 0)
+        {
+            std::cerr << "nosey did not start listening on " << port << std::endl;
+            return 1;
+        }
+
+        load_results results = {};
+        double seconds = 0;
+        {
+            std::unique_ptr<reactor> events = make_reactor(bench_reactor);
+            std::vector<load_client*> reconnects;
+            std::vector<std::unique_ptr<load_client>> clients;
+            for (int n = 0; n < connections; n++)
+            {
+                clients.emplace_back(new load_client(*events, loopback(port), message, 1, results, reconnects));
+                clients.back()->connect();
+            }
+
+            auto start = bench_clock::now();
+            while (seconds_since(start) < duration)
+            {
+                events->wait(10);
+                std::vector<load_client*> due;
+                due.swap(reconnects);
+                for (auto client : due)
+                    client->connect();
+            }
+            seconds = seconds_since(start);
+        }
+        double cpu = stop_nosey(child);
+
+        std::sort(results.connect_ns.begin(), results.connect_ns.end());
+        size_t count = results.round_trip_ns.size();
+        std::cout << "churn\t" << (copy ? "copy" : "splice") << "\t" << count << "\t"
+            << std::fixed << std::setprecision(3) << seconds << "\t"
+            << std::setprecision(0) << (count / seconds) << "\t"
+            << std::setprecision(2) << (count > 0 ? cpu * 1e6 / count : 0) << "\t"
+            << std::setprecision(1) << load_results::percentile(results.connect_ns, 0.5) << "\t"
+            << load_results::percentile(results.connect_ns, 0.99) << "\t"
+            << results.errors << std::endl;
+    }
+    return 0;
+}
+
+// what the dispatch bench does with each chunk: queue it and flush it straight away, the way the
+// relay hands a read to the other side, so the call has real work to be inlined into
+struct dispatch_sink
+{
+    write_queue queue;
+    uint64_t chunks;
+
+    void take(const uint8_t* data, int length)
+    {
+        queue.append(data, length);
+        queue.consume(queue.size());
+        chunks++;
+    }
+};
+
+// the handler compiled into the connection, against function_handler's std::functions
+struct static_handler
+{
+    dispatch_sink* sink;
+
+    explicit static_handler(dispatch_sink* s) :
+        sink(s)
+    {
+    }
+
+    void on_connect()
+    {
+    }
+
+    void on_receive(const uint8_t* data, int length)
+    {
+        sink->take(data, length);
+    }
+
+    void on_disconnect()
+    {
+    }
+
+    bool on_connect_failed()
+    {
+        return false;
+    }
+};
+
+function_handler make_function_handler(dispatch_sink* sink)
+{
+    return function_handler(
+        []()
+        {
+        },
+        [sink](const uint8_t* data, int length)
+        {
+            sink->take(data, length);
+        },
+        []()
+        {
+        });
+}
+
+// the handler called on its own, count chunks from a buffer, nanoseconds per chunk
+template <typename handler_type>
+double run_dispatch_call(handler_type handler, dispatch_sink& sink, size_t chunk, size_t count)
+{
+    std::vector<uint8_t> data(chunk + 4096, 0x5a);
+    auto start = bench_clock::now();
+    for (size_t n = 0; n < count; n++)
+        handler.on_receive(data.data() + (n & 4095), (int) chunk);
+    double seconds = seconds_since(start);
+    return (sink.chunks == count) ? seconds * 1e9 / count : 0;
+}
+
+// the whole read path: a chunk sent into a socketpair, then read by a server connection, nanoseconds per chunk
+template <typename handler_type>
+double run_dispatch_socket(handler_type handler, dispatch_sink& sink, size_t chunk, size_t count)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return 0;
+
+    std::unique_ptr<reactor> events = make_reactor("poll");
+    basic_server_connection<handler_type> connection(*events, handler);
+    set_nonblocking(fds[0]);
+    connection.accept(fds[0]);
+    std::vector<uint8_t> data(chunk, 0x5a);
+    auto start = bench_clock::now();
+    for (size_t n = 0; n < count; n++)
+    {
+        if (::send(fds[1], data.data(), chunk, MSG_NOSIGNAL) != (ssize_t) chunk)
+            break;
+        connection.on_io(io_readable);
+    }
+    double seconds = seconds_since(start);
+    connection.disconnect();
+    close(fds[1]);
+    return (sink.chunks == count) ? seconds * 1e9 / count : 0;
+}
+
+// per chunk cost of handing reads to the owner through std::function and through a handler type
+// the connection is compiled with, alone and as part of a real read
+int bench_dispatch(int argc, char** argv)
+{
+    size_t count = 10000000;
+    if (argc > 0)
+        count = std::max(strtoull(argv[0], nullptr, 10), 1ULL) * 1000000;
+
+    std::cout << "bench\tvariant\tchunk bytes\tchunks\tns/chunk" << std::endl;
+    for (size_t chunk : { (size_t) 16, (size_t) 512, (size_t) 4096 })
+    {
+        for (int socket = 0; socket < 2; socket++)
+        {
+            size_t n = socket ? count / 20 : count;
+            dispatch_sink function_sink = {};
+            dispatch_sink static_sink = {};
+            double function_ns = socket ? run_dispatch_socket(make_function_handler(&function_sink), function_sink, chunk, n)
+                : run_dispatch_call(make_function_handler(&function_sink), function_sink, chunk, n);
+            double static_ns = socket ? run_dispatch_socket(static_handler(&static_sink), static_sink, chunk, n)
+                : run_dispatch_call(static_handler(&static_sink), static_sink, chunk, n);
+
+            const char* name = socket ? "dispatch-socket" : "dispatch-call";
+            std::cout << std::fixed << std::setprecision(2)
+                << name << "\tfunction\t" << chunk << "\t" << n << "\t" << function_ns << std::endl
+                << name << "\tstatic\t" << chunk << "\t" << n << "\t" << static_ns << std::endl;
+        }
+    }
+    return 0;
+}
+
+void usage()
+{
+    std::cerr << "usage: " << std::endl;
+    std::cerr << "\tnosey-bench <benchmark> [arguments]" << std::endl << std::endl;
+    std::cerr << "benchmark listing:" << std::endl;
+    std::cerr << "\tqueue [megabytes per transfer size, 16]" << std::endl;
+    std::cerr << "\thexdump [megabytes, 64]" << std::endl;
+    std::cerr << "\tthroughput <proxy port> <sink port> [megabytes, 256] [connections, 1] [label]" << std::endl;
+    std::cerr << "\techo <nosey path> <first proxy port> <echo port> [seconds, 2] [connections, 8] [message bytes, 64] [reactors, poll epoll uring]" << std::endl;
+    std::cerr << "\tload <nosey path> <first proxy port> <echo port> [seconds, 2] [connections, 16] [message bytes, 64,4096] [requests per connection, 0 to keep it] [nosey options]" << std::endl;
+    std::cerr << "\tdispatch [million chunks, 10]" << std::endl;
+    std::cerr << "\tchurn <nosey path> <first proxy port> <echo port> [seconds, 2] [connections, 16] [message bytes, 64] [nosey options]" << std::endl;
+    std::cerr << "\tscaling <nosey path> <first proxy port> <backend port> [max threads, cpus] [megabytes, 256] [connections, 8]" << std::endl;
+    std::cerr << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string benchmark = (argc > 1) ? argv[1] : "";
+    if (benchmark == "queue")
+        return bench_queue(argc - 2, argv + 2);
+    if (benchmark == "hexdump")
+        return bench_hexdump(argc - 2, argv + 2);
+    if (benchmark == "dispatch")
+        return bench_dispatch(argc - 2, argv + 2);
+    if ((benchmark == "throughput") && (bench_throughput(argc - 2, argv + 2) == 0))
+        return 0;
+    if ((benchmark == "echo") && (bench_echo(argc - 2, argv + 2) == 0))
+        return 0;
+    if ((benchmark == "scaling") && (bench_scaling(argc - 2, argv + 2) == 0))
+        return 0;
+    if ((benchmark == "load") && (bench_load(argc - 2, argv + 2) == 0))
+        return 0;
+    if ((benchmark == "churn") && (bench_churn(argc - 2, argv + 2) == 0))
+        return 0;
+
+    usage();
+    return -1;
+}
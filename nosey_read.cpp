@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "hex_dump.h"
+#include "log_format.h"
+#include "segment_log.h"
+
+// turns nosey's segment files back into the hex dump it would have printed
+
+bool report_ip = false;
+bool report_port = false;
+bool report_time = false;
+int report_width = 8;
+int report_repeats = 3;
+uint64_t only_session = 0; // 0 for every session
+
+void usage()
+{
+    std::cerr << "usage: " << std::endl;
+    std::cerr << "\tnosey-read [options] <segment file>..." << std::endl << std::endl;
+    std::cerr << "options:" << std::endl;
+    std::cerr << "\t-w/--report-width, " << report_width << std::endl;
+    std::cerr << "\t-r/--report-repeats, " << report_repeats << std::endl;
+    std::cerr << "\t-t/--report-time" << std::endl;
+    std::cerr << "\t-i/--report-ip" << std::endl;
+    std::cerr << "\t-n/--report-port" << std::endl;
+    std::cerr << "\t-v/--verbose" << std::endl;
+    std::cerr << "\t-s/--session, only this session, numbered from 1 as they started" << std::endl;
+    std::cerr << std::endl;
+}
+
+bool dump_segment(const std::string& path)
+{
+    segment_reader reader;
+    if (!reader.open(path))
+    {
+        std::cerr << "not a segment file: " << path << std::endl;
+        return false;
+    }
+
+    hex_dumper dumper;
+    log_clock clock;
+    std::string prefix;
+    std::string out;
+    while (const segment_record* r = reader.next())
+    {
+        if ((only_session != 0) && (r->session != only_session))
+            continue;
+
+        prefix.clear();
+        if (report_time)
+            prefix += clock.format(segment_reader::time(*r));
+        prefix += r->dir_in ? '>' : '<';
+        prefix += endpoint_text(segment_reader::source(*r), report_ip, report_port);
+        dumper.format(out, prefix.data(), prefix.size(), report_width, report_repeats, r->payload(), segment_reader::payload_length(*r));
+
+        if (out.size() > (1 << 20))
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> files;
+    std::string argument_to_parse;
+    bool help = false;
+    for (int n = 1; n < argc; n++)
+    {
+        std::string arg = argv[n];
+        if (argument_to_parse.empty())
+        {
+            if ((arg == "-w") || (arg == "--report-width"))
+            {
+                argument_to_parse = "report-width";
+            }
+            else if ((arg == "-r") || (arg == "--report-repeats"))
+            {
+                argument_to_parse = "report-repeats";
+            }
+            else if ((arg == "-s") || (arg == "--session"))
+            {
+                argument_to_parse = "session";
+            }
+            else if ((arg == "-t") || (arg == "--report-time"))
+            {
+                report_time = true;
+            }
+            else if ((arg == "-i") || (arg == "--report-ip"))
+            {
+                report_ip = true;
+            }
+            else if ((arg == "-n") || (arg == "--report-port"))
+            {
+                report_port = true;
+            }
+            else if ((arg == "-v") || (arg == "--verbose"))
+            {
+                report_ip = true;
+                report_port = true;
+            }
+            else if ((arg == "-?") || (arg == "--help") || (arg[0] == '-'))
+            {
+                help = true;
+            }
+            else
+            {
+                files.push_back(arg);
+            }
+        }
+        else
+        {
+            if (argument_to_parse == "report-width")
+                report_width = std::max(atoi(arg.c_str()), 1);
+            else if (argument_to_parse == "report-repeats")
+                report_repeats = std::max(atoi(arg.c_str()), 1);
+            else if (argument_to_parse == "session")
+                only_session = strtoull(arg.c_str(), nullptr, 10);
+            argument_to_parse.clear();
+        }
+    }
+
+    if (help || files.empty() || !argument_to_parse.empty())
+    {
+        usage();
+        return -1;
+    }
+
+    int result = 0;
+    for (auto& file : files)
+    {
+        if (!dump_segment(file))
+            result = -1;
+    }
+    return result;
+}
@@ -0,0 +1,469 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <csignal>
+
+#include "connection.h"
+#include "segment_log.h"
+
+// plays the client side of sessions nosey kept in segment files against a server, at the recorded
+// pace, faster, or as fast as the server answers, and compares response times with the recording
+
+// connection.h leaves its tuning to the program, these are nosey's defaults
+size_t read_buffer_size = 1 << 16;
+size_t io_budget = 1 << 20;
+size_t high_watermark = 1 << 20;
+size_t low_watermark = 1 << 18;
+socket_tuning tcp_tuning = { false, false, 0, 0, 0, SOMAXCONN };
+
+double speed = 1; // 0 for as fast as the server answers
+size_t concurrency = 256; // sessions replayed at once
+int stall_timeout = 1000; // ms to wait for a response that doesn't come
+uint64_t only_session = 0; // 0 for every session
+bool verbose = false;
+#ifdef __linux__
+std::string reactor_backend = "epoll";
+#else
+std::string reactor_backend = "poll";
+#endif
+
+// what the client sent between two of the server's replies, and how the server answered it
+struct turn
+{
+    std::string data;
+    int64_t at_ns; // when its last chunk was received, from the start of the session
+    size_t response_bytes; // what the server sent back before the client spoke again
+    int64_t response_ns; // from the last chunk to the first byte of the response, -1 for none
+};
+
+struct recording
+{
+    uint64_t session;
+    int64_t start_ns; // system clock, the session's first record
+    std::vector<turn> turns;
+};
+
+// every session in the files, in the order they started
+bool load_recordings(const std::vector<std::string>& files, std::vector<recording>& recordings)
+{
+    std::unordered_map<uint64_t, size_t> index;
+    for (auto& file : files)
+    {
+        segment_reader reader;
+        if (!reader.open(file))
+        {
+            std::cerr << "not a segment file: " << file << std::endl;
+            return false;
+        }
+
+        while (const segment_record* r = reader.next())
+        {
+            if ((only_session != 0) && (r->session != only_session))
+                continue;
+
+            auto found = index.find(r->session);
+            if (found == index.end())
+            {
+                found = index.emplace(r->session, recordings.size()).first;
+                recording fresh = { r->session, r->time_ns, {} };
+                recordings.push_back(fresh);
+            }
+
+            recording& s = recordings[found->second];
+            size_t length = segment_reader::payload_length(*r);
+            if (r->dir_in)
+            {
+                // a client chunk after the server has replied starts a new turn
+                if (s.turns.empty() || (s.turns.back().response_bytes > 0))
+                    s.turns.push_back({ std::string(), 0, 0, -1 });
+                s.turns.back().data.append((const char*) r->payload(), length);
+                s.turns.back().at_ns = r->time_ns - s.start_ns;
+            }
+            else if (!s.turns.empty())
+            {
+                turn& t = s.turns.back();
+                if (t.response_bytes == 0)
+                    t.response_ns = r->time_ns - s.start_ns - t.at_ns;
+                t.response_bytes += length;
+            }
+        }
+    }
+
+    std::stable_sort(recordings.begin(), recordings.end(),
+        [](const recording& a, const recording& b)
+        {
+            return a.start_ns < b.start_ns;
+        });
+    return true;
+}
+
+struct replay_results
+{
+    std::vector<uint64_t> response_ns; // replayed, for turns that had a response both times
+    std::vector<uint64_t> original_ns; // the same turns as recorded
+    uint64_t turns;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t timeouts; // responses that didn't come within the stall timeout
+    uint64_t errors; // sessions the server closed or refused before they were done
+
+    static double percentile(std::vector<uint64_t>& samples, double q)
+    {
+        if (samples.empty())
+            return 0;
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, (size_t) (q * samples.size()))] / 1e3;
+    }
+};
+
+// one recorded session played over nosey's client_connection
+// timed, each turn goes out when the recording says it did, divided by the speed; at full speed
+// the next turn waits for as much response as the recording had, or the stall timeout
+class replay_session
+{
+    struct waiting
+    {
+        io_clock::time_point sent_at;
+        int64_t original_ns;
+        size_t bytes_left;
+        bool answered;
+    };
+
+    client_connection connection_;
+    const recording& recording_;
+    replay_results& results_;
+    io_clock::time_point start_;
+    io_clock::time_point progress_; // last send or receive, for the stall timeout
+    size_t next_;
+    std::deque<waiting> waiting_;
+    bool connected_;
+    bool done_;
+
+    io_clock::time_point due_at(const turn& t) const
+    {
+        return start_ + std::chrono::duration_cast<io_clock::duration>(std::chrono::nanoseconds((int64_t) (t.at_ns / speed)));
+    }
+
+    void send_turn(io_clock::time_point now)
+    {
+        const turn& t = recording_.turns[next_++];
+        connection_.send((const uint8_t*) t.data.data(), (int) t.data.size());
+        results_.turns++;
+        results_.bytes_sent += t.data.size();
+        if (t.response_bytes > 0)
+            waiting_.push_back({ now, t.response_ns, t.response_bytes, false });
+        progress_ = now;
+    }
+
+    void on_recv(int length)
+    {
+        io_clock::time_point now = io_clock::now();
+        results_.bytes_received += length;
+        progress_ = now;
+
+        size_t left = length;
+        while ((left > 0) && !waiting_.empty())
+        {
+            waiting& w = waiting_.front();
+            if (!w.answered)
+            {
+                w.answered = true;
+                results_.response_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - w.sent_at).count());
+                results_.original_ns.push_back(w.original_ns);
+            }
+            size_t n = std::min(left, w.bytes_left);
+            w.bytes_left -= n;
+            left -= n;
+            if (w.bytes_left == 0)
+                waiting_.pop_front();
+        }
+    }
+
+    void finish(bool failed)
+    {
+        if (done_)
+            return;
+        if (failed)
+            results_.errors++;
+        done_ = true;
+        connection_.close_after_flush();
+    }
+
+public:
+    replay_session(reactor& r, const recording& recorded, replay_results& results) :
+        connection_(
+            r,
+            [this]()
+            {
+                connected_ = true;
+            },
+            [this](const uint8_t*, int length)
+            {
+                on_recv(length);
+            },
+            [this]()
+            {
+                finish((next_ < recording_.turns.size()) || !waiting_.empty());
+            },
+            nullptr),
+        recording_(recorded),
+        results_(results),
+        next_(0),
+        connected_(false),
+        done_(false)
+    {
+    }
+
+    void start(const sockaddr_in& destination)
+    {
+        start_ = progress_ = io_clock::now();
+        connection_.connect(destination);
+    }
+
+    // finished, and what it last sent has gone
+    bool done() const
+    {
+        return done_ && !connection_.is_active();
+    }
+
+    uint64_t session() const
+    {
+        return recording_.session;
+    }
+
+    double seconds() const
+    {
+        return std::chrono::duration<double>(progress_ - start_).count();
+    }
+
+    // sends what is due, gives up on a response after the stall timeout, and says when it next
+    // needs a look
+    io_clock::time_point run(io_clock::time_point now)
+    {
+        if (done_)
+            return io_clock::time_point::max();
+
+        if (!waiting_.empty() && (now - progress_ >= std::chrono::milliseconds(stall_timeout)))
+        {
+            results_.timeouts += waiting_.size();
+            waiting_.clear();
+        }
+
+        const std::vector<turn>& turns = recording_.turns;
+        if (speed > 0)
+        {
+            while ((next_ < turns.size()) && (due_at(turns[next_]) <= now))
+                send_turn(now);
+        }
+        else if (connected_ && waiting_.empty() && (next_ < turns.size()))
+        {
+            send_turn(now);
+        }
+
+        if ((next_ == turns.size()) && waiting_.empty())
+        {
+            finish(false);
+            return io_clock::time_point::max();
+        }
+
+        io_clock::time_point due = progress_ + std::chrono::milliseconds(stall_timeout);
+        if ((speed > 0) && (next_ < turns.size()))
+            due = std::min(due, due_at(turns[next_]));
+        return due;
+    }
+};
+
+void usage()
+{
+    std::cerr << "usage: " << std::endl;
+    std::cerr << "\tnosey-replay [options] <host:port> <segment file>..." << std::endl << std::endl;
+    std::cerr << "options:" << std::endl;
+    std::cerr << "\t-x/--speed, " << speed << " (times the recorded pace, max to send each turn as soon as the last was answered)" << std::endl;
+    std::cerr << "\t-c/--concurrency, " << concurrency << " (sessions at once)" << std::endl;
+    std::cerr << "\t-o/--stall-timeout, " << stall_timeout << " (ms to wait for a response)" << std::endl;
+    std::cerr << "\t-s/--session, only this session, numbered from 1 as they started" << std::endl;
+#ifdef __linux__
+    std::cerr << "\t-e/--reactor, " << reactor_backend << " (epoll or poll)" << std::endl;
+#endif
+    std::cerr << "\t-v/--verbose, a row per session" << std::endl;
+    std::cerr << std::endl;
+}
+
+bool parse_destination(const std::string& text, sockaddr_in& addr)
+{
+    size_t colon = text.find(':');
+    if (colon == std::string::npos)
+        return false;
+    int port = atoi(text.c_str() + colon + 1);
+    if ((port <= 0) || (port > 65535))
+        return false;
+
+    addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u_short) port);
+    return inet_aton(text.substr(0, colon).c_str(), &addr.sin_addr) != 0;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> positional;
+    std::string argument_to_parse;
+    bool help = false;
+    for (int n = 1; n < argc; n++)
+    {
+        std::string arg = argv[n];
+        if (argument_to_parse.empty())
+        {
+            if ((arg == "-x") || (arg == "--speed"))
+            {
+                argument_to_parse = "speed";
+            }
+            else if ((arg == "-c") || (arg == "--concurrency"))
+            {
+                argument_to_parse = "concurrency";
+            }
+            else if ((arg == "-o") || (arg == "--stall-timeout"))
+            {
+                argument_to_parse = "stall-timeout";
+            }
+            else if ((arg == "-s") || (arg == "--session"))
+            {
+                argument_to_parse = "session";
+            }
+            else if ((arg == "-e") || (arg == "--reactor"))
+            {
+                argument_to_parse = "reactor";
+            }
+            else if ((arg == "-v") || (arg == "--verbose"))
+            {
+                verbose = true;
+            }
+            else if ((arg == "-?") || (arg == "--help") || (arg[0] == '-'))
+            {
+                help = true;
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+        else
+        {
+            if (argument_to_parse == "speed")
+                speed = (arg == "max") ? 0 : std::max(atof(arg.c_str()), 0.0);
+            else if (argument_to_parse == "concurrency")
+                concurrency = std::max(atoi(arg.c_str()), 1);
+            else if (argument_to_parse == "stall-timeout")
+                stall_timeout = std::max(atoi(arg.c_str()), 1);
+            else if (argument_to_parse == "session")
+                only_session = strtoull(arg.c_str(), nullptr, 10);
+            else if (argument_to_parse == "reactor")
+                reactor_backend = arg;
+            argument_to_parse.clear();
+        }
+    }
+
+    sockaddr_in destination = { 0 };
+    if (!help && (positional.size() >= 2) && !parse_destination(positional[0], destination))
+    {
+        std::cerr << "invalid address: " << positional[0] << std::endl;
+        help = true;
+    }
+    std::unique_ptr<reactor> events = make_reactor(reactor_backend);
+    if (!events)
+    {
+        std::cerr << "unknown reactor: " << reactor_backend << std::endl;
+        help = true;
+    }
+    if (help || (positional.size() < 2) || !argument_to_parse.empty())
+    {
+        usage();
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<recording> recordings;
+    if (!load_recordings(std::vector<std::string>(positional.begin() + 1, positional.end()), recordings))
+        return -1;
+
+    replay_results results = {};
+    std::vector<std::unique_ptr<replay_session>> active;
+    size_t started = 0;
+    auto begin = io_clock::now();
+    int64_t first_ns = recordings.empty() ? 0 : recordings.front().start_ns;
+    while ((started < recordings.size()) || !active.empty())
+    {
+        io_clock::time_point now = io_clock::now();
+        io_clock::time_point due = now + std::chrono::milliseconds(10);
+
+        // sessions start at their recorded offsets too, unless replaying flat out
+        while ((started < recordings.size()) && (active.size() < concurrency))
+        {
+            const recording& next = recordings[started];
+            io_clock::time_point start_at = begin;
+            if (speed > 0)
+                start_at += std::chrono::duration_cast<io_clock::duration>(std::chrono::nanoseconds((int64_t) ((next.start_ns - first_ns) / speed)));
+            if (start_at > now)
+            {
+                due = std::min(due, start_at);
+                break;
+            }
+            active.emplace_back(new replay_session(*events, next, results));
+            active.back()->start(destination);
+            started++;
+        }
+
+        // sessions are only let go between loop turns, never inside their own callbacks
+        for (size_t n = 0; n < active.size();)
+        {
+            due = std::min(due, active[n]->run(now));
+            if (active[n]->done())
+            {
+                if (verbose)
+                    std::cerr << "session " << active[n]->session() << " took " << active[n]->seconds() << "s" << std::endl;
+                active.erase(active.begin() + n);
+            }
+            else
+            {
+                n++;
+            }
+        }
+
+        if (!active.empty() || (started < recordings.size()))
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - io_clock::now()).count();
+            events->wait((int) std::max<int64_t>(wait, 0));
+        }
+    }
+    double seconds = std::chrono::duration<double>(io_clock::now() - begin).count();
+
+    std::cout << "replay\tspeed\tsessions\tturns\tbytes sent\tbytes received\tseconds\ttimeouts\terrors"
+        "\tresponses\tp50 us\tp99 us\tp999 us\trecorded p50 us\trecorded p99 us\trecorded p999 us" << std::endl;
+    std::ostringstream pace;
+    if (speed > 0)
+        pace << speed;
+    else
+        pace << "max";
+    std::cout << "replay\t" << pace.str() << "\t"
+        << recordings.size() << "\t" << results.turns << "\t" << results.bytes_sent << "\t" << results.bytes_received << "\t"
+        << std::fixed << std::setprecision(3) << seconds << "\t"
+        << results.timeouts << "\t" << results.errors << "\t" << results.response_ns.size() << "\t"
+        << std::setprecision(1)
+        << replay_results::percentile(results.response_ns, 0.5) << "\t"
+        << replay_results::percentile(results.response_ns, 0.99) << "\t"
+        << replay_results::percentile(results.response_ns, 0.999) << "\t"
+        << replay_results::percentile(results.original_ns, 0.5) << "\t"
+        << replay_results::percentile(results.original_ns, 0.99) << "\t"
+        << replay_results::percentile(results.original_ns, 0.999) << std::endl;
+    return 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+// writes relayed data as a pcapng capture that wireshark and tcpdump can open
+// each received chunk becomes one raw IPv4/TCP packet with synthesised headers, blocks are
+// built in memory and reach the file in large writes
+class pcapng_writer
+{
+public:
+    static const size_t header_size = 40; // IPv4 and TCP, neither with options
+    static const size_t max_payload = 65535 - header_size;
+
+private:
+    static const uint32_t section_header_block = 0x0a0d0d0a;
+    static const uint32_t interface_description_block = 1;
+    static const uint32_t enhanced_packet_block = 6;
+    static const uint16_t linktype_raw = 101; // packets start at the IP header
+    static const size_t flush_size = 1 << 20;
+
+    FILE* file_;
+    std::string buffer_;
+    uint16_t ip_id_;
+
+    pcapng_writer(const pcapng_writer&) = delete;
+    void operator=(const pcapng_writer&) = delete;
+
+    // pcapng fields are in the writer's byte order, the reader works it out from the section header
+    template <typename value>
+    void put(value v)
+    {
+        buffer_.append((const char*) &v, sizeof(v));
+    }
+
+    static void put_be16(uint8_t* p, uint16_t v)
+    {
+        p[0] = (uint8_t) (v >> 8);
+        p[1] = (uint8_t) v;
+    }
+
+    static void put_be32(uint8_t* p, uint32_t v)
+    {
+        p[0] = (uint8_t) (v >> 24);
+        p[1] = (uint8_t) (v >> 16);
+        p[2] = (uint8_t) (v >> 8);
+        p[3] = (uint8_t) v;
+    }
+
+    static uint16_t ip_checksum(const uint8_t* header, size_t length)
+    {
+        uint32_t sum = 0;
+        for (size_t n = 0; n + 1 < length; n += 2)
+            sum += (header[n] << 8) | header[n + 1];
+        while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+        return (uint16_t) ~sum;
+    }
+
+public:
+    pcapng_writer() :
+        file_(nullptr),
+        ip_id_(0)
+    {
+    }
+
+    ~pcapng_writer()
+    {
+        close();
+    }
+
+    bool is_open() const
+    {
+        return file_ != nullptr;
+    }
+
+    bool open(const std::string& path)
+    {
+        close();
+        file_ = fopen(path.c_str(), "wb");
+        if (file_ == nullptr)
+            return false;
+
+        buffer_.reserve(flush_size * 2);
+
+        put(section_header_block);
+        put((uint32_t) 28);
+        put((uint32_t) 0x1a2b3c4d);
+        put((uint16_t) 1);
+        put((uint16_t) 0);
+        put((int64_t) -1); // section length not known up front
+        put((uint32_t) 28);
+
+        put(interface_description_block);
+        put((uint32_t) 20);
+        put(linktype_raw);
+        put((uint16_t) 0);
+        put((uint32_t) 0); // no snap length, everything is kept
+        put((uint32_t) 20);
+
+        flush();
+        return true;
+    }
+
+    // one TCP segment carrying data from source to destination, timestamps in microseconds
+    // the TCP checksum is left at zero (wireshark doesn't check it by default), the IP one is filled in
+    void packet(
+        std::chrono::system_clock::time_point time,
+        const sockaddr_in& source,
+        const sockaddr_in& destination,
+        uint32_t seq,
+        uint32_t ack,
+        const uint8_t* data,
+        size_t length)
+    {
+        if (file_ == nullptr)
+            return;
+
+        length = std::min(length, max_payload);
+        size_t captured = header_size + length;
+        size_t padded = (captured + 3) & ~(size_t) 3;
+        uint32_t block_length = (uint32_t) (32 + padded);
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+
+        put(enhanced_packet_block);
+        put(block_length);
+        put((uint32_t) 0);
+        put((uint32_t) (micros >> 32));
+        put((uint32_t) micros);
+        put((uint32_t) captured);
+        put((uint32_t) captured);
+
+        uint8_t headers[header_size] = {0};
+        uint8_t* ip = headers;
+        ip[0] = 0x45;
+        put_be16(ip + 2, (uint16_t) captured);
+        put_be16(ip + 4, ip_id_++);
+        put_be16(ip + 6, 0x4000); // don't fragment
+        ip[8] = 64;
+        ip[9] = IPPROTO_TCP;
+        memcpy(ip + 12, &source.sin_addr, 4);
+        memcpy(ip + 16, &destination.sin_addr, 4);
+        put_be16(ip + 10, ip_checksum(ip, 20));
+
+        uint8_t* tcp = headers + 20;
+        memcpy(tcp, &source.sin_port, 2);
+        memcpy(tcp + 2, &destination.sin_port, 2);
+        put_be32(tcp + 4, seq);
+        put_be32(tcp + 8, ack);
+        tcp[12] = 5 << 4;
+        tcp[13] = 0x18; // PSH, ACK
+        put_be16(tcp + 14, 65535);
+
+        buffer_.append((const char*) headers, header_size);
+        buffer_.append((const char*) data, length);
+        buffer_.append(padded - captured, '\0');
+        put(block_length);
+
+        if (buffer_.size() >= flush_size)
+            flush();
+    }
+
+    void flush()
+    {
+        if ((file_ == nullptr) || buffer_.empty())
+            return;
+        fwrite(buffer_.data(), 1, buffer_.size(), file_);
+        fflush(file_);
+        buffer_.clear();
+    }
+
+    void close()
+    {
+        if (file_ == nullptr)
+            return;
+        flush();
+        fclose(file_);
+        file_ = nullptr;
+    }
+};
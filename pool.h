@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// allocation for the things every session makes and throws away, so that once an event loop has
+// seen its busiest moment a new session costs no trips to the heap
+// both belong to one thread: a slab to the event loop that owns it, buffers to the thread they're on
+
+// objects of one type made in blocks and kept on a free list when they're destroyed, the memory
+// goes back to the heap with the slab
+template <class T>
+class slab
+{
+    static const size_t block_size = 64;
+
+    struct slot
+    {
+        slot* next_free;
+        bool live;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* object()
+        {
+            return reinterpret_cast<T*>(storage);
+        }
+    };
+
+    std::vector<std::unique_ptr<slot[]>> blocks_;
+    slot* free_;
+    size_t size_;
+
+    slab(const slab&) = delete;
+    void operator=(const slab&) = delete;
+
+    static slot* slot_of(T* object)
+    {
+        return reinterpret_cast<slot*>(reinterpret_cast<unsigned char*>(object) - offsetof(slot, storage));
+    }
+
+    void grow()
+    {
+        blocks_.emplace_back(new slot[block_size]);
+        slot* block = blocks_.back().get();
+        for (size_t n = block_size; n > 0; n--)
+        {
+            block[n - 1].live = false;
+            block[n - 1].next_free = free_;
+            free_ = &block[n - 1];
+        }
+    }
+
+public:
+    slab() :
+        free_(nullptr),
+        size_(0)
+    {
+    }
+
+    ~slab()
+    {
+        for_each([this](T* object)
+            {
+                destroy(object);
+            });
+    }
+
+    template <class... args_type>
+    T* create(args_type&&... args)
+    {
+        if (free_ == nullptr)
+            grow();
+
+        slot* s = free_;
+        T* object = new (s->storage) T(std::forward<args_type>(args)...);
+        free_ = s->next_free;
+        s->live = true;
+        size_++;
+        return object;
+    }
+
+    void destroy(T* object)
+    {
+        slot* s = slot_of(object);
+        object->~T();
+        s->live = false;
+        s->next_free = free_;
+        free_ = s;
+        size_--;
+    }
+
+    // objects made and not yet destroyed
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // room for this many without growing
+    size_t capacity() const
+    {
+        return blocks_.size() * block_size;
+    }
+
+    // each live object, which f may destroy
+    template <class function_type>
+    void for_each(function_type f)
+    {
+        for (auto& block : blocks_)
+        {
+            for (size_t n = 0; n < block_size; n++)
+            {
+                if (block[n].live)
+                    f(block[n].object());
+            }
+        }
+    }
+};
+
+// fixed size buffers borrowed and given back on one thread, the ones given back are kept for
+// the next borrower up to a limit and the rest freed, so a burst doesn't pin its memory for good
+template <size_t buffer_size>
+class buffer_pool
+{
+    std::vector<void*> free_;
+    size_t keep_;
+    size_t outstanding_;
+
+    buffer_pool(const buffer_pool&) = delete;
+    void operator=(const buffer_pool&) = delete;
+
+public:
+    explicit buffer_pool(size_t keep) :
+        keep_(keep),
+        outstanding_(0)
+    {
+    }
+
+    ~buffer_pool()
+    {
+        for (void* buffer : free_)
+            ::operator delete(buffer);
+    }
+
+    // this thread's pool, keeping up to 4 MB of buffers idle
+    static buffer_pool& local()
+    {
+        static thread_local buffer_pool pool(std::max<size_t>((4 << 20) / buffer_size, 1));
+        return pool;
+    }
+
+    void* borrow()
+    {
+        outstanding_++;
+        if (free_.empty())
+            return ::operator new(buffer_size);
+        void* buffer = free_.back();
+        free_.pop_back();
+        return buffer;
+    }
+
+    void give_back(void* buffer)
+    {
+        outstanding_--;
+        if (free_.size() < keep_)
+            free_.push_back(buffer);
+        else
+            ::operator delete(buffer);
+    }
+
+    size_t idle() const
+    {
+        return free_.size();
+    }
+
+    size_t outstanding() const
+    {
+        return outstanding_;
+    }
+};
@@ -0,0 +1,746 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "timer_wheel.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+typedef int socklen_t;
+#else
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#ifdef NOSEY_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+const SOCKET INVALID_SOCKET = -1;
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// descriptor readiness and the event loops that wait for it, poll everywhere, epoll on linux and
+// io_uring when built with NOSEY_IO_URING; nosey and nosey-bench both run on these
+
+inline void set_nonblocking(SOCKET fd)
+{
+    if (fd < 0) return;
+
+#ifdef _WIN32
+   unsigned long mode = 1;
+   ioctlsocket(fd, FIONBIO, &mode);
+#else
+   int flags = fcntl(fd, F_GETFL, 0);
+   if (flags == -1) return;
+
+   flags = (flags | O_NONBLOCK);
+   fcntl(fd, F_SETFL, flags);
+#endif
+}
+inline void cleanup_socket(SOCKET fd)
+{
+#ifdef _WIN32
+    closesocket(fd);
+#else
+    close(fd);
+#endif
+}
+
+// a nonblocking tcp socket, in the one call where the system allows it
+inline SOCKET open_stream_socket()
+{
+#ifdef SOCK_NONBLOCK
+    return socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+#else
+    SOCKET fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd != INVALID_SOCKET)
+        set_nonblocking(fd);
+    return fd;
+#endif
+}
+
+// the next connection waiting on a listener, nonblocking already, INVALID_SOCKET once there are none
+inline SOCKET accept_socket(SOCKET listener, sockaddr_in* far_end)
+{
+    socklen_t length = sizeof(sockaddr_in);
+#ifdef SOCK_NONBLOCK
+    return accept4(listener, (sockaddr*) far_end, (far_end != nullptr) ? &length : nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    SOCKET fd = accept(listener, (sockaddr*) far_end, (far_end != nullptr) ? &length : nullptr);
+    if (fd != INVALID_SOCKET)
+        set_nonblocking(fd);
+    return fd;
+#endif
+}
+typedef std::chrono::steady_clock io_clock;
+
+enum io_events
+{
+    io_readable = 1,
+    io_writable = 2,
+    io_hangup = 4
+};
+
+class io_handler
+{
+public:
+    virtual ~io_handler() {}
+    virtual void on_io(int events) = 0;
+};
+
+// a reactor owns the wait for descriptor readiness and dispatches only the handlers that are ready
+class reactor
+{
+protected:
+    struct ready_event
+    {
+        SOCKET fd;
+        io_handler* handler;
+        int events;
+    };
+
+    std::vector<ready_event> posted_;
+    std::vector<ready_event> ready_;
+    std::chrono::nanoseconds last_turn_; // time spent in handlers, not waiting
+    timer_wheel timers_;
+
+    void dispatch()
+    {
+        // handlers may post or remove while we run, posted work waits for the next turn
+        ready_.insert(ready_.end(), posted_.begin(), posted_.end());
+        posted_.clear();
+        auto started = io_clock::now();
+        size_t expired = timers_.expire(started);
+        if (ready_.empty())
+        {
+            last_turn_ = (expired > 0) ? io_clock::now() - started : std::chrono::nanoseconds::zero();
+            return;
+        }
+
+        for (size_t n = 0; n < ready_.size(); n++)
+        {
+            ready_event e = ready_[n];
+            if (e.handler != nullptr)
+                e.handler->on_io(e.events);
+        }
+        ready_.clear();
+        last_turn_ = io_clock::now() - started;
+    }
+
+    // the wait ends in time for the next timer
+    int next_timeout(int timeout_ms) const
+    {
+        return posted_.empty() ? timers_.next_timeout(timeout_ms) : 0;
+    }
+
+public:
+    reactor() :
+        last_turn_(0)
+    {
+    }
+
+    virtual ~reactor() {}
+
+    // how long the last wait spent running handlers, zero if nothing was ready
+    std::chrono::nanoseconds last_turn() const
+    {
+        return last_turn_;
+    }
+
+    // timeouts run on this loop, between its waits
+    timer_wheel& timers()
+    {
+        return timers_;
+    }
+
+    virtual const char* name() const = 0;
+    // a descriptor that failed to open, INVALID_SOCKET, is ignored
+    virtual void add(SOCKET fd, io_handler* handler, int events) = 0;
+    virtual void update(SOCKET fd, io_handler* handler, int events) = 0;
+    virtual void wait(int timeout_ms) = 0;
+
+    virtual void remove(SOCKET fd)
+    {
+        for (auto& e : ready_)
+        {
+            if (e.fd == fd)
+                e.handler = nullptr;
+        }
+        posted_.erase(
+            std::remove_if(
+                posted_.begin(),
+                posted_.end(),
+                [fd](const ready_event& e) { return e.fd == fd; }),
+            posted_.end());
+    }
+
+    // run a handler on the next turn without waiting on its descriptor
+    void post(SOCKET fd, io_handler* handler, int events)
+    {
+        posted_.push_back({fd, handler, events});
+    }
+};
+
+// portable fallback, level triggered, the pollfd set is kept between waits and patched in place
+class poll_reactor : public reactor
+{
+    std::vector<pollfd> descriptors_;
+    std::vector<io_handler*> handlers_;
+    std::unordered_map<SOCKET, size_t> index_;
+
+    static short to_poll(int events)
+    {
+        short result = POLLERR | POLLHUP;
+        if (events & io_readable)
+        {
+            result |= POLLIN;
+#ifndef _WIN32
+            result |= POLLRDHUP;
+#endif
+        }
+        if (events & io_writable)
+            result |= POLLOUT;
+        return result;
+    }
+
+public:
+    const char* name() const override
+    {
+        return "poll";
+    }
+
+    void add(SOCKET fd, io_handler* handler, int events) override
+    {
+        if (fd == INVALID_SOCKET)
+            return;
+
+        pollfd selector;
+        selector.fd = fd;
+        selector.events = to_poll(events);
+        selector.revents = 0;
+
+        index_[fd] = descriptors_.size();
+        descriptors_.push_back(selector);
+        handlers_.push_back(handler);
+    }
+
+    void update(SOCKET fd, io_handler* handler, int events) override
+    {
+        auto it = index_.find(fd);
+        if (it == index_.end())
+            return;
+        descriptors_[it->second].events = to_poll(events);
+        handlers_[it->second] = handler;
+    }
+
+    void remove(SOCKET fd) override
+    {
+        reactor::remove(fd);
+
+        auto it = index_.find(fd);
+        if (it == index_.end())
+            return;
+
+        size_t n = it->second;
+        index_.erase(it);
+        if (n + 1 != descriptors_.size())
+        {
+            descriptors_[n] = descriptors_.back();
+            handlers_[n] = handlers_.back();
+            index_[descriptors_[n].fd] = n;
+        }
+        descriptors_.pop_back();
+        handlers_.pop_back();
+    }
+
+    void wait(int timeout_ms) override
+    {
+#ifdef _WIN32
+        int n = WSAPoll(descriptors_.data(), (ULONG) descriptors_.size(), next_timeout(timeout_ms));
+#else
+        int n = ::poll(descriptors_.data(), descriptors_.size(), next_timeout(timeout_ms));
+#endif
+        for (size_t i = 0; (n > 0) && (i < descriptors_.size()); i++)
+        {
+            short revents = descriptors_[i].revents;
+            if (revents == 0)
+                continue;
+            n--;
+
+            int events = 0;
+            if (revents & POLLIN)
+                events |= io_readable;
+            if (revents & POLLOUT)
+                events |= io_writable;
+#ifdef _WIN32
+            if (revents & (POLLERR | POLLHUP))
+#else
+            if (revents & (POLLERR | POLLHUP | POLLRDHUP))
+#endif
+                events |= io_hangup | io_readable;
+            ready_.push_back({descriptors_[i].fd, handlers_[i], events});
+        }
+        dispatch();
+    }
+};
+
+#ifdef __linux__
+// edge triggered, descriptors are registered once and interest changes never touch the kernel
+class epoll_reactor : public reactor
+{
+    int epoll_;
+    std::vector<io_handler*> handlers_;
+    std::vector<int> interest_;
+    std::vector<epoll_event> events_;
+
+public:
+    epoll_reactor() :
+        epoll_(epoll_create1(EPOLL_CLOEXEC)),
+        events_(256)
+    {
+    }
+
+    ~epoll_reactor()
+    {
+        if (epoll_ >= 0)
+            close(epoll_);
+    }
+
+    const char* name() const override
+    {
+        return "epoll";
+    }
+
+    void add(SOCKET fd, io_handler* handler, int events) override
+    {
+        if (fd < 0)
+            return;
+        if ((size_t) fd >= handlers_.size())
+        {
+            handlers_.resize(fd + 1, nullptr);
+            interest_.resize(fd + 1, 0);
+        }
+        handlers_[fd] = handler;
+        interest_[fd] = events;
+
+        epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void update(SOCKET fd, io_handler* handler, int events) override
+    {
+        if ((size_t) fd >= handlers_.size())
+            return;
+
+        // an edge we ignored while not interested will not come again, so fake one
+        int raised = events & ~interest_[fd];
+        handlers_[fd] = handler;
+        interest_[fd] = events;
+        if (raised != 0)
+            post(fd, handler, raised);
+    }
+
+    void remove(SOCKET fd) override
+    {
+        reactor::remove(fd);
+        if ((size_t) fd < handlers_.size())
+        {
+            handlers_[fd] = nullptr;
+            interest_[fd] = 0;
+        }
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void wait(int timeout_ms) override
+    {
+        int n = epoll_wait(epoll_, events_.data(), (int) events_.size(), next_timeout(timeout_ms));
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events_[i].data.fd;
+            uint32_t revents = events_[i].events;
+
+            int events = 0;
+            if (revents & EPOLLIN)
+                events |= io_readable;
+            if (revents & EPOLLOUT)
+                events |= io_writable;
+            events &= interest_[fd];
+            if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                events |= io_hangup | (interest_[fd] & io_readable);
+
+            if ((events != 0) && (handlers_[fd] != nullptr))
+                ready_.push_back({fd, handlers_[fd], events});
+        }
+        if ((size_t) n == events_.size())
+            events_.resize(events_.size() * 2);
+        dispatch();
+    }
+};
+#endif
+
+#ifdef NOSEY_IO_URING
+// io_uring, driven with raw syscalls so liburing isn't needed
+// each descriptor gets one multishot poll request, which behaves like an edge triggered epoll
+// registration; arming, disarming and waiting all reach the kernel in one io_uring_enter per turn
+class uring_reactor : public reactor
+{
+    static const unsigned ring_entries = 256;
+    static const unsigned completion_entries = 4096;
+    static const uint64_t ignored = ~(uint64_t) 0; // completions of our own poll removals, and of the multishot probe
+
+    int ring_;
+    void* sq_map_;
+    size_t sq_map_size_;
+    void* cq_map_;
+    size_t cq_map_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    io_uring_cqe* cqes_;
+    unsigned cq_mask_;
+    unsigned pending_; // queued since the last enter
+
+    std::vector<io_handler*> handlers_;
+    std::vector<int> interest_;
+    std::vector<uint32_t> generation_; // tells this registration's completions from an earlier owner of the fd
+    std::vector<SOCKET> rearm_;
+
+    static uint64_t token(SOCKET fd, uint32_t generation)
+    {
+        return ((uint64_t) generation << 32) | (uint32_t) fd;
+    }
+
+    int enter(unsigned submit, unsigned wait, unsigned flags, const void* arg, size_t arg_size)
+    {
+        return (int) syscall(__NR_io_uring_enter, ring_, submit, wait, flags, arg, arg_size);
+    }
+
+    io_uring_sqe* next_sqe()
+    {
+        // the kernel hasn't taken the last ring full yet, hand it over first
+        if (*sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == ring_entries)
+        {
+            enter(pending_, 0, 0, nullptr, 0);
+            pending_ = 0;
+        }
+        io_uring_sqe* sqe = &sqes_[*sq_tail_ & sq_mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void queue_sqe()
+    {
+        unsigned tail = *sq_tail_;
+        sq_array_[tail & sq_mask_] = tail & sq_mask_;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        pending_++;
+    }
+
+    void arm(SOCKET fd)
+    {
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN | POLLOUT | POLLRDHUP | POLLERR | POLLHUP;
+        sqe->user_data = token(fd, generation_[fd]);
+        queue_sqe();
+    }
+
+    // multishot poll came in 5.13, and no feature bit says so: an earlier kernel refuses the request,
+    // so arm one on an eventfd, make it readable and see that it comes back with more to follow
+    bool multishot_poll()
+    {
+        int probe = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (probe < 0)
+            return false;
+
+        // it goes on its own, so its refusal or its event is the only completion there can be
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = probe;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = ignored;
+        queue_sqe();
+        enter(pending_, 0, 0, nullptr, 0);
+        pending_ = 0;
+
+        uint64_t one = 1;
+        bool supported = false;
+        if (write(probe, &one, sizeof(one)) == sizeof(one))
+        {
+            enter(0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            unsigned head = *cq_head_;
+            if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                supported = (cqe.res > 0) && (cqe.flags & IORING_CQE_F_MORE);
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        // still armed when it worked, the removal goes with the first wait and wait skips what it completes
+        if (supported)
+        {
+            sqe = next_sqe();
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = ignored;
+            sqe->user_data = ignored;
+            queue_sqe();
+        }
+        close(probe);
+        return supported;
+    }
+
+    void disarm(SOCKET fd)
+    {
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = token(fd, generation_[fd]);
+        sqe->user_data = ignored;
+        queue_sqe();
+    }
+
+public:
+    uring_reactor() :
+        ring_(-1),
+        sq_map_(MAP_FAILED),
+        sq_map_size_(0),
+        cq_map_(MAP_FAILED),
+        cq_map_size_(0),
+        sqes_((io_uring_sqe*) MAP_FAILED),
+        sqes_size_(0),
+        pending_(0)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = completion_entries;
+        ring_ = (int) syscall(__NR_io_uring_setup, ring_entries, &params);
+        if (ring_ < 0)
+            return;
+        if (!(params.features & IORING_FEAT_EXT_ARG))
+        {
+            // waiting with a timeout needs 5.11 or later, and multishot poll 5.13, checked once the rings are mapped
+            close(ring_);
+            ring_ = -1;
+            return;
+        }
+
+        sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQ_RING);
+        cq_map_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_CQ_RING);
+        sqes_ = (io_uring_sqe*) mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES);
+        if ((sq_map_ == MAP_FAILED) || (cq_map_ == MAP_FAILED) || (sqes_ == MAP_FAILED))
+        {
+            close(ring_);
+            ring_ = -1;
+            return;
+        }
+
+        uint8_t* sq = (uint8_t*) sq_map_;
+        sq_head_ = (unsigned*) (sq + params.sq_off.head);
+        sq_tail_ = (unsigned*) (sq + params.sq_off.tail);
+        sq_array_ = (unsigned*) (sq + params.sq_off.array);
+        sq_mask_ = *(unsigned*) (sq + params.sq_off.ring_mask);
+
+        uint8_t* cq = (uint8_t*) cq_map_;
+        cq_head_ = (unsigned*) (cq + params.cq_off.head);
+        cq_tail_ = (unsigned*) (cq + params.cq_off.tail);
+        cqes_ = (io_uring_cqe*) (cq + params.cq_off.cqes);
+        cq_mask_ = *(unsigned*) (cq + params.cq_off.ring_mask);
+
+        if (!multishot_poll())
+        {
+            close(ring_);
+            ring_ = -1;
+        }
+    }
+
+    ~uring_reactor()
+    {
+        if (sqes_ != MAP_FAILED)
+            munmap(sqes_, sqes_size_);
+        if (cq_map_ != MAP_FAILED)
+            munmap(cq_map_, cq_map_size_);
+        if (sq_map_ != MAP_FAILED)
+            munmap(sq_map_, sq_map_size_);
+        if (ring_ >= 0)
+            close(ring_);
+    }
+
+    bool is_open() const
+    {
+        return ring_ >= 0;
+    }
+
+    const char* name() const override
+    {
+        return "uring";
+    }
+
+    void add(SOCKET fd, io_handler* handler, int events) override
+    {
+        if (fd < 0)
+            return;
+        if ((size_t) fd >= handlers_.size())
+        {
+            handlers_.resize(fd + 1, nullptr);
+            interest_.resize(fd + 1, 0);
+            generation_.resize(fd + 1, 0);
+        }
+        handlers_[fd] = handler;
+        interest_[fd] = events;
+        generation_[fd]++;
+        arm(fd);
+    }
+
+    void update(SOCKET fd, io_handler* handler, int events) override
+    {
+        if ((size_t) fd >= handlers_.size())
+            return;
+
+        // same as epoll, an edge that came while we weren't interested won't come again
+        int raised = events & ~interest_[fd];
+        handlers_[fd] = handler;
+        interest_[fd] = events;
+        if (raised != 0)
+            post(fd, handler, raised);
+    }
+
+    void remove(SOCKET fd) override
+    {
+        reactor::remove(fd);
+        if (((size_t) fd >= handlers_.size()) || (handlers_[fd] == nullptr))
+            return;
+
+        disarm(fd);
+        handlers_[fd] = nullptr;
+        interest_[fd] = 0;
+        generation_[fd]++;
+    }
+
+    void wait(int timeout_ms) override
+    {
+        int timeout = next_timeout(timeout_ms);
+        __kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+
+        bool waiting = (timeout > 0) && (__atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) == *cq_head_);
+        enter(pending_, waiting ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        pending_ = 0;
+
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            if (cqe.user_data == ignored)
+                continue;
+
+            SOCKET fd = (SOCKET) (uint32_t) cqe.user_data;
+            if (((size_t) fd >= handlers_.size()) || (generation_[fd] != (uint32_t) (cqe.user_data >> 32)) || (handlers_[fd] == nullptr))
+                continue;
+
+            if (cqe.res < 0)
+            {
+                // the poll itself failed and would fail again if rearmed: a socket we can't wait on is no
+                // use, so shut it and let its owner find it closed
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    shutdown(fd, SHUT_RDWR);
+                    ready_.push_back({fd, handlers_[fd], io_hangup | io_readable});
+                }
+                continue;
+            }
+
+            // the kernel ended the multishot request cleanly (the completion queue overflowed), it needs another one
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+                rearm_.push_back(fd);
+
+            int events = 0;
+            if (cqe.res & POLLIN)
+                events |= io_readable;
+            if (cqe.res & POLLOUT)
+                events |= io_writable;
+            events &= interest_[fd];
+            if (cqe.res & (POLLERR | POLLHUP | POLLRDHUP))
+                events |= io_hangup | (interest_[fd] & io_readable);
+
+            if (events != 0)
+                ready_.push_back({fd, handlers_[fd], events});
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        for (SOCKET fd : rearm_)
+        {
+            if (handlers_[fd] != nullptr)
+                arm(fd);
+        }
+        rearm_.clear();
+        dispatch();
+    }
+};
+#endif
+
+inline std::unique_ptr<reactor> make_reactor(const std::string& name)
+{
+#ifdef __linux__
+    if (name == "epoll")
+        return std::unique_ptr<reactor>(new epoll_reactor());
+#endif
+#ifdef NOSEY_IO_URING
+    if (name == "uring")
+    {
+        std::unique_ptr<uring_reactor> uring(new uring_reactor());
+        if (uring->is_open())
+            return std::unique_ptr<reactor>(uring.release());
+        return nullptr;
+    }
+#endif
+    if (name == "poll")
+        return std::unique_ptr<reactor>(new poll_reactor());
+    return nullptr;
+}
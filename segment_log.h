@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// received data kept in segment files: each is preallocated, mapped, and cut into fixed size
+// records that event loops fill in directly, claiming one with an atomic add on the segment's
+// cursor and marking it done with a release store of its length, so nothing queues behind a lock
+// a segment that fills up or outlives its time is retired for a new one, and only the last few are kept
+// fields are in the writer's byte order, addresses and ports as they are in a sockaddr_in
+
+const size_t segment_record_size = 4096;
+
+struct segment_file_header
+{
+    char magic[8]; // "NOSEYSEG"
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t records; // how many records follow the header block
+    uint64_t number; // counts up from 1 as segments rotate
+    int64_t opened_ns; // system clock
+};
+
+struct segment_record
+{
+    std::atomic<uint32_t> length; // of the payload plus one, stored last, 0 for a record never finished
+    uint8_t dir_in; // from the client, as a dump line starting with >
+    uint8_t reserved[3];
+    uint64_t session; // counts up from 1 as sessions start
+    int64_t time_ns; // system clock
+    uint32_t source_addr;
+    uint32_t destination_addr;
+    uint16_t source_port;
+    uint16_t destination_port;
+    uint32_t reserved2;
+    // and then the payload, up to the end of the record
+
+    uint8_t* payload()
+    {
+        return (uint8_t*) this + sizeof(*this);
+    }
+
+    const uint8_t* payload() const
+    {
+        return (const uint8_t*) this + sizeof(*this);
+    }
+};
+
+const size_t segment_payload_size = segment_record_size - sizeof(segment_record);
+
+// the name of segment number in a rotation writing to base
+inline std::string segment_name(const std::string& base, uint64_t number)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%06llu", (unsigned long long) number);
+    return base + suffix;
+}
+
+class segment_log
+{
+    // segments are used round robin from a few slots, so a slot isn't remapped while a writer
+    // that picked it up just before it was retired could still be looking at it
+    static const size_t slot_count = 4;
+
+    struct segment
+    {
+        int fd;
+        uint8_t* base;
+        size_t records;
+        int64_t expires_ns; // 0 when only size rotates it
+        uint64_t number;
+        std::atomic<uint64_t> cursor; // records claimed, may run past records
+        std::atomic<int> writers;
+
+        segment() :
+            fd(-1),
+            base(nullptr),
+            records(0),
+            expires_ns(0),
+            number(0),
+            cursor(0),
+            writers(0)
+        {
+        }
+    };
+
+    std::string base_name_;
+    size_t segment_records_;
+    int64_t segment_ns_;
+    size_t keep_;
+    segment slots_[slot_count];
+    std::atomic<segment*> current_;
+    std::mutex rotate_mutex_;
+    std::atomic<uint64_t> lost_;
+
+    segment_log(const segment_log&) = delete;
+    void operator=(const segment_log&) = delete;
+
+    static int64_t now_ns(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    bool open_segment(segment& s, uint64_t number, int64_t now)
+    {
+        std::string path = segment_name(base_name_, number);
+        size_t size = (segment_records_ + 1) * segment_record_size;
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+#ifdef __linux__
+        bool sized = posix_fallocate(fd, 0, size) == 0;
+#else
+        bool sized = ftruncate(fd, size) == 0;
+#endif
+        void* base = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (base == MAP_FAILED)
+        {
+            ::close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+
+        segment_file_header header = {};
+        memcpy(header.magic, "NOSEYSEG", 8);
+        header.version = 1;
+        header.record_size = segment_record_size;
+        header.records = segment_records_;
+        header.number = number;
+        header.opened_ns = now;
+        memcpy(base, &header, sizeof(header));
+
+        s.fd = fd;
+        s.base = (uint8_t*) base;
+        s.records = segment_records_;
+        s.expires_ns = (segment_ns_ > 0) ? now + segment_ns_ : 0;
+        s.number = number;
+        s.cursor.store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    // cut back to the records that were claimed, so a segment retired early isn't mostly empty
+    void close_segment(segment& s)
+    {
+        if (s.base == nullptr)
+            return;
+        size_t used = (size_t) std::min<uint64_t>(s.cursor.load(), s.records);
+        munmap(s.base, (s.records + 1) * segment_record_size);
+        if (ftruncate(s.fd, (used + 1) * segment_record_size) != 0)
+        {
+            // the file keeps its preallocated size, readers skip the unused records
+        }
+        ::close(s.fd);
+        s.fd = -1;
+        s.base = nullptr;
+    }
+
+    // whoever finds the current segment full opens the next; the retired one is closed once the
+    // writers that already had a record in it are done
+    void rotate(segment* full, int64_t now)
+    {
+        std::lock_guard<std::mutex> lock(rotate_mutex_);
+        if (current_.load() != full)
+            return;
+
+        segment* next = &slots_[(full - slots_ + 1) % slot_count];
+        bool opened = open_segment(*next, full->number + 1, now);
+        current_.store(opened ? next : nullptr);
+        while (full->writers.load() != 0)
+            std::this_thread::yield();
+        close_segment(*full);
+
+        if (opened && (next->number > keep_))
+            unlink(segment_name(base_name_, next->number - keep_).c_str());
+    }
+
+    bool append_record(
+        uint64_t session,
+        bool dir_in,
+        const sockaddr_in& source,
+        const sockaddr_in& destination,
+        int64_t now,
+        const uint8_t* data,
+        size_t length)
+    {
+        for (;;)
+        {
+            segment* s = current_.load();
+            if (s == nullptr)
+                return false;
+
+            // announce ourselves, then check the segment wasn't retired meanwhile
+            s->writers.fetch_add(1);
+            if (current_.load() != s)
+            {
+                s->writers.fetch_sub(1);
+                continue;
+            }
+
+            uint64_t n = s->cursor.fetch_add(1, std::memory_order_relaxed);
+            if ((n < s->records) && ((s->expires_ns == 0) || (now < s->expires_ns)))
+            {
+                segment_record* r = (segment_record*) (s->base + (n + 1) * segment_record_size);
+                r->dir_in = dir_in ? 1 : 0;
+                r->session = session;
+                r->time_ns = now;
+                r->source_addr = source.sin_addr.s_addr;
+                r->destination_addr = destination.sin_addr.s_addr;
+                r->source_port = source.sin_port;
+                r->destination_port = destination.sin_port;
+                memcpy(r->payload(), data, length);
+                r->length.store((uint32_t) length + 1, std::memory_order_release);
+                s->writers.fetch_sub(1);
+                return true;
+            }
+
+            s->writers.fetch_sub(1);
+            rotate(s, now);
+        }
+    }
+
+public:
+    segment_log() :
+        segment_records_(0),
+        segment_ns_(0),
+        keep_(0),
+        current_(nullptr),
+        lost_(0)
+    {
+    }
+
+    ~segment_log()
+    {
+        close();
+    }
+
+    // segments of segment_bytes at base.000001, base.000002 and so on, each kept open at most
+    // seconds when that isn't 0, with only the newest keep of them left on disk
+    bool open(const std::string& base, size_t segment_bytes, int seconds, size_t keep)
+    {
+        close();
+        base_name_ = base;
+        segment_records_ = std::max(segment_bytes / segment_record_size, (size_t) 2) - 1;
+        segment_ns_ = (int64_t) seconds * 1000000000;
+        keep_ = std::max(keep, (size_t) 1);
+        if (!open_segment(slots_[0], 1, now_ns(std::chrono::system_clock::now())))
+            return false;
+        current_.store(&slots_[0]);
+        return true;
+    }
+
+    // still true after a failed rotation, records are counted as lost from then on
+    bool is_open() const
+    {
+        return !base_name_.empty();
+    }
+
+    // records that couldn't be written because a new segment couldn't be opened
+    uint64_t lost() const
+    {
+        return lost_;
+    }
+
+    // any thread, a chunk longer than a record's payload takes several
+    void append(
+        uint64_t session,
+        bool dir_in,
+        const sockaddr_in& source,
+        const sockaddr_in& destination,
+        std::chrono::system_clock::time_point time,
+        const uint8_t* data,
+        size_t length)
+    {
+        int64_t now = now_ns(time);
+        for (size_t offs = 0; offs < length; offs += segment_payload_size)
+        {
+            size_t n = std::min(segment_payload_size, length - offs);
+            if (!append_record(session, dir_in, source, destination, now, data + offs, n))
+                lost_++;
+        }
+    }
+
+    // once nothing else appends
+    void close()
+    {
+        segment* s = current_.exchange(nullptr);
+        if (s != nullptr)
+            close_segment(*s);
+        base_name_.clear();
+    }
+};
+
+// reads a segment file back, record by record in the order they were claimed
+class segment_reader
+{
+    FILE* file_;
+    segment_file_header header_;
+    uint8_t record_[segment_record_size];
+    uint64_t read_;
+
+    segment_reader(const segment_reader&) = delete;
+    void operator=(const segment_reader&) = delete;
+
+public:
+    segment_reader() :
+        file_(nullptr),
+        read_(0)
+    {
+    }
+
+    ~segment_reader()
+    {
+        close();
+    }
+
+    bool open(const std::string& path)
+    {
+        close();
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == nullptr)
+            return false;
+
+        uint8_t block[segment_record_size];
+        if ((fread(block, 1, sizeof(block), file_) != sizeof(block))
+            || (memcpy(&header_, block, sizeof(header_)), memcmp(header_.magic, "NOSEYSEG", 8) != 0)
+            || (header_.version != 1)
+            || (header_.record_size != segment_record_size))
+        {
+            close();
+            return false;
+        }
+        read_ = 0;
+        return true;
+    }
+
+    const segment_file_header& header() const
+    {
+        return header_;
+    }
+
+    // the next finished record, nullptr at the end of the segment
+    const segment_record* next()
+    {
+        while ((file_ != nullptr) && (read_ < header_.records))
+        {
+            if (fread(record_, 1, sizeof(record_), file_) != sizeof(record_))
+                return nullptr;
+            read_++;
+            const segment_record* r = (const segment_record*) record_;
+            uint32_t length = r->length.load(std::memory_order_relaxed);
+            if ((length > 0) && (length - 1 <= segment_payload_size))
+                return r;
+        }
+        return nullptr;
+    }
+
+    static size_t payload_length(const segment_record& r)
+    {
+        return r.length.load(std::memory_order_relaxed) - 1;
+    }
+
+    static sockaddr_in source(const segment_record& r)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = r.source_addr;
+        addr.sin_port = r.source_port;
+        return addr;
+    }
+
+    static sockaddr_in destination(const segment_record& r)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = r.destination_addr;
+        addr.sin_port = r.destination_port;
+        return addr;
+    }
+
+    static std::chrono::system_clock::time_point time(const segment_record& r)
+    {
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(r.time_ns)));
+    }
+
+    void close()
+    {
+        if (file_ != nullptr)
+            fclose(file_);
+        file_ = nullptr;
+    }
+};
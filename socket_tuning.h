@@ -0,0 +1,64 @@
+#pragma once
+
+#include "reactor.h"
+
+// socket options for the connections nosey makes and accepts, and for its listeners; a zero
+// leaves the system's own setting, options a platform doesn't have are skipped
+
+struct socket_tuning
+{
+    bool no_delay; // TCP_NODELAY: small writes go straight out rather than wait on an ack
+    bool quick_ack; // TCP_QUICKACK: acknowledge at once rather than delay (linux, the kernel may turn it back off)
+    int buffer_bytes; // SO_RCVBUF and SO_SNDBUF
+    int defer_accept; // TCP_DEFER_ACCEPT seconds: only wake the listener once the client has sent something (linux)
+    int fast_open; // TCP_FASTOPEN queue length on listeners
+    int backlog; // listen() backlog
+};
+
+// each program defines this, nosey from its command line
+extern socket_tuning tcp_tuning;
+
+inline void set_socket_option(SOCKET fd, int level, int name, int value)
+{
+    setsockopt(fd, level, name, (const char*) &value, sizeof(value));
+}
+
+// buffer sizes go on before connect or listen, so the window scale they need is offered in the handshake
+inline void tune_buffers(SOCKET fd)
+{
+    if (tcp_tuning.buffer_bytes > 0)
+    {
+        set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, tcp_tuning.buffer_bytes);
+        set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, tcp_tuning.buffer_bytes);
+    }
+}
+
+// an accepted socket, or one about to connect out
+inline void tune_connection(SOCKET fd, bool outgoing)
+{
+    if (tcp_tuning.no_delay)
+        set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+#ifdef TCP_QUICKACK
+    if (tcp_tuning.quick_ack)
+        set_socket_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+    // accepted sockets have the listener's buffer sizes already
+    // no TCP_FASTOPEN_CONNECT going out: connect would report success before the handshake, and a
+    // refused backend would look like a dropped session rather than a failed connect to fail over from
+    if (outgoing)
+        tune_buffers(fd);
+}
+
+// before listen
+inline void tune_listener(SOCKET fd)
+{
+    tune_buffers(fd);
+#ifdef TCP_DEFER_ACCEPT
+    if (tcp_tuning.defer_accept > 0)
+        set_socket_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, tcp_tuning.defer_accept);
+#endif
+#ifdef TCP_FASTOPEN
+    if (tcp_tuning.fast_open > 0)
+        set_socket_option(fd, IPPROTO_TCP, TCP_FASTOPEN, tcp_tuning.fast_open);
+#endif
+}
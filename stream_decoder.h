@@ -0,0 +1,420 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+
+// splits one direction of a session into messages as the bytes arrive, without copying them,
+// so the dump can be filtered message by message and we only format what we want to see
+// every run of bytes handed on belongs to one message and is either its header or its body
+
+enum message_part
+{
+    part_header,
+    part_body
+};
+
+class message_sink
+{
+public:
+    virtual ~message_sink() {}
+    // end is set on the run that finishes the message
+    virtual void part(const uint8_t* data, size_t length, int kind, bool end) = 0;
+};
+
+class stream_decoder
+{
+public:
+    virtual ~stream_decoder() {}
+    virtual void feed(const uint8_t* data, size_t length, message_sink& sink) = 0;
+};
+
+// no framing, each read is a message of its own
+class read_decoder : public stream_decoder
+{
+public:
+    void feed(const uint8_t* data, size_t length, message_sink& sink) override
+    {
+        sink.part(data, length, part_header, true);
+    }
+};
+
+// messages end with a delimiter byte, newline for text protocols
+class delimiter_decoder : public stream_decoder
+{
+    uint8_t delimiter_;
+
+public:
+    explicit delimiter_decoder(uint8_t delimiter) :
+        delimiter_(delimiter)
+    {
+    }
+
+    void feed(const uint8_t* data, size_t length, message_sink& sink) override
+    {
+        while (length > 0)
+        {
+            const uint8_t* found = (const uint8_t*) memchr(data, delimiter_, length);
+            if (found == nullptr)
+            {
+                sink.part(data, length, part_header, false);
+                return;
+            }
+
+            size_t n = found - data + 1;
+            sink.part(data, n, part_header, true);
+            data += n;
+            length -= n;
+        }
+    }
+};
+
+// each message is an unsigned length of 1, 2, 4 or 8 bytes and then that many bytes of body,
+// the length doesn't count itself
+class length_decoder : public stream_decoder
+{
+    size_t prefix_size_;
+    bool little_endian_;
+    size_t prefix_seen_;
+    uint8_t prefix_[8];
+    uint64_t remaining_;
+
+public:
+    length_decoder(size_t prefix_size, bool little_endian) :
+        prefix_size_(prefix_size),
+        little_endian_(little_endian),
+        prefix_seen_(0),
+        remaining_(0)
+    {
+    }
+
+    void feed(const uint8_t* data, size_t length, message_sink& sink) override
+    {
+        while (length > 0)
+        {
+            if (prefix_seen_ < prefix_size_)
+            {
+                size_t n = std::min(length, prefix_size_ - prefix_seen_);
+                memcpy(prefix_ + prefix_seen_, data, n);
+                prefix_seen_ += n;
+                data += n;
+                length -= n;
+                if (prefix_seen_ < prefix_size_)
+                {
+                    sink.part(data - n, n, part_header, false);
+                    return;
+                }
+
+                remaining_ = 0;
+                for (size_t b = 0; b < prefix_size_; b++)
+                    remaining_ = (remaining_ << 8) | prefix_[little_endian_ ? prefix_size_ - 1 - b : b];
+                sink.part(data - n, n, part_header, remaining_ == 0);
+                if (remaining_ == 0)
+                    prefix_seen_ = 0;
+                continue;
+            }
+
+            size_t n = (size_t) std::min<uint64_t>(length, remaining_);
+            remaining_ -= n;
+            sink.part(data, n, part_body, remaining_ == 0);
+            if (remaining_ == 0)
+                prefix_seen_ = 0;
+            data += n;
+            length -= n;
+        }
+    }
+};
+
+// HTTP/1.x requests or responses: the header block, then a body sized by Content-Length or sent
+// chunked; a response with neither runs to the end of the connection
+// responses are framed without seeing the request, so the body of a reply to HEAD is assumed
+class http_decoder : public stream_decoder
+{
+    static const size_t max_header = 65536; // past this it isn't HTTP, pass the rest on as body
+
+    enum state
+    {
+        in_header,
+        in_body, // remaining_ bytes of body, or to the end when until_close_
+        in_chunk_size,
+        in_chunk_data, // remaining_ bytes of chunk and its CRLF
+        in_trailer
+    };
+
+    int state_;
+    std::string header_; // the header block so far, needed to find the body length
+    std::string line_; // a chunk size or trailer line so far
+    uint64_t remaining_;
+    bool until_close_;
+
+    static bool starts_with(const std::string& text, size_t offs, const char* prefix)
+    {
+        size_t length = strlen(prefix);
+        if (offs + length > text.size())
+            return false;
+        for (size_t n = 0; n < length; n++)
+        {
+            if (tolower((unsigned char) text[offs + n]) != prefix[n])
+                return false;
+        }
+        return true;
+    }
+
+    // the header is complete, work out what follows it
+    void start_body()
+    {
+        bool chunked = false;
+        bool has_length = false;
+        remaining_ = 0;
+        for (size_t line = header_.find('\n'); line != std::string::npos; line = header_.find('\n', line + 1))
+        {
+            if (starts_with(header_, line + 1, "content-length:"))
+            {
+                remaining_ = strtoull(header_.c_str() + line + 16, nullptr, 10);
+                has_length = true;
+            }
+            else if (starts_with(header_, line + 1, "transfer-encoding:"))
+            {
+                size_t end = header_.find('\n', line + 1);
+                chunked = header_.substr(line + 19, end - line - 19).find("chunked") != std::string::npos;
+            }
+        }
+
+        until_close_ = false;
+        if (chunked)
+        {
+            state_ = in_chunk_size;
+            line_.clear();
+        }
+        else if (has_length)
+        {
+            state_ = in_body;
+        }
+        else if (starts_with(header_, 0, "http/"))
+        {
+            int status = atoi(header_.c_str() + std::min(header_.find(' '), header_.size()));
+            until_close_ = (status >= 200) && (status != 204) && (status != 304);
+            state_ = in_body;
+        }
+        else
+        {
+            state_ = in_body;
+        }
+    }
+
+    void finish()
+    {
+        state_ = in_header;
+        header_.clear();
+    }
+
+public:
+    http_decoder() :
+        state_(in_header),
+        remaining_(0),
+        until_close_(false)
+    {
+    }
+
+    void feed(const uint8_t* data, size_t length, message_sink& sink) override
+    {
+        while (length > 0)
+        {
+            switch (state_)
+            {
+            case in_header:
+            {
+                // the blank line may straddle two reads, so look a few bytes back into what we have
+                size_t before = header_.size();
+                size_t from = before - std::min(before, (size_t) 3);
+                header_.append((const char*) data, std::min(length, max_header - before));
+                size_t end = header_.find("\r\n\r\n", from);
+                size_t blank = 4;
+                if (end == std::string::npos)
+                {
+                    end = header_.find("\n\n", from);
+                    blank = 2;
+                }
+
+                if (end == std::string::npos)
+                {
+                    size_t n = header_.size() - before;
+                    if (header_.size() == max_header)
+                    {
+                        until_close_ = true;
+                        state_ = in_body;
+                    }
+                    sink.part(data, n, part_header, false);
+                    data += n;
+                    length -= n;
+                    break;
+                }
+
+                size_t n = end + blank - before;
+                header_.resize(end + blank);
+                start_body();
+                bool done = (state_ == in_body) && !until_close_ && (remaining_ == 0);
+                sink.part(data, n, part_header, done);
+                if (done)
+                    finish();
+                data += n;
+                length -= n;
+                break;
+            }
+            case in_body:
+            {
+                size_t n = until_close_ ? length : (size_t) std::min<uint64_t>(length, remaining_);
+                if (!until_close_)
+                    remaining_ -= n;
+                bool done = !until_close_ && (remaining_ == 0);
+                sink.part(data, n, part_body, done);
+                if (done)
+                    finish();
+                data += n;
+                length -= n;
+                break;
+            }
+            case in_chunk_size:
+            case in_trailer:
+            {
+                const uint8_t* newline = (const uint8_t*) memchr(data, '\n', length);
+                size_t n = (newline == nullptr) ? length : (size_t) (newline - data + 1);
+                if (line_.size() < 256)
+                    line_.append((const char*) data, std::min(n, 256 - line_.size()));
+                bool done = false;
+                if (newline != nullptr)
+                {
+                    if (state_ == in_chunk_size)
+                    {
+                        remaining_ = strtoull(line_.c_str(), nullptr, 16);
+                        state_ = (remaining_ == 0) ? in_trailer : in_chunk_data;
+                        remaining_ += 2;
+                    }
+                    else if ((line_ == "\r\n") || (line_ == "\n"))
+                    {
+                        done = true;
+                    }
+                    line_.clear();
+                }
+                sink.part(data, n, part_body, done);
+                if (done)
+                    finish();
+                data += n;
+                length -= n;
+                break;
+            }
+            case in_chunk_data:
+            {
+                size_t n = (size_t) std::min<uint64_t>(length, remaining_);
+                remaining_ -= n;
+                if (remaining_ == 0)
+                    state_ = in_chunk_size;
+                sink.part(data, n, part_body, false);
+                data += n;
+                length -= n;
+                break;
+            }
+            }
+        }
+    }
+};
+
+// none, line, delim:<byte or 0xNN>, length:<1|2|4|8>[:le|:be] or http, nullptr for anything else
+inline std::unique_ptr<stream_decoder> make_decoder(const std::string& spec)
+{
+    if (spec == "none")
+        return std::unique_ptr<stream_decoder>(new read_decoder());
+    if (spec == "line")
+        return std::unique_ptr<stream_decoder>(new delimiter_decoder('\n'));
+    if (spec == "http")
+        return std::unique_ptr<stream_decoder>(new http_decoder());
+    if ((spec.compare(0, 6, "delim:") == 0) && (spec.size() == 7))
+        return std::unique_ptr<stream_decoder>(new delimiter_decoder((uint8_t) spec[6]));
+    if ((spec.compare(0, 8, "delim:0x") == 0) && (spec.size() == 10))
+        return std::unique_ptr<stream_decoder>(new delimiter_decoder((uint8_t) strtoul(spec.c_str() + 8, nullptr, 16)));
+    if (spec.compare(0, 7, "length:") == 0)
+    {
+        size_t size = strtoul(spec.c_str() + 7, nullptr, 10);
+        std::string order = spec.substr(std::min(spec.size(), (size_t) 8));
+        if (((size == 1) || (size == 2) || (size == 4) || (size == 8)) && (order.empty() || (order == ":le") || (order == ":be")))
+            return std::unique_ptr<stream_decoder>(new length_decoder(size, order == ":le"));
+    }
+    return nullptr;
+}
+
+// what of a direction's messages reaches the dump: with a pattern only messages containing it,
+// with headers_only only the header part of each; a message waits here until it matches, up to
+// max_held bytes, one that hasn't matched by then isn't logged
+class message_filter : public message_sink
+{
+    static const size_t max_held = 65536;
+
+    std::unique_ptr<stream_decoder> decoder_;
+    std::string pattern_;
+    bool headers_only_;
+    std::function<void (const uint8_t*, size_t)> log_;
+    std::string held_;
+    bool matched_;
+    bool skipping_;
+
+public:
+    message_filter(
+        std::unique_ptr<stream_decoder> decoder,
+        const std::string& pattern,
+        bool headers_only,
+        std::function<void (const uint8_t*, size_t)> log
+    ) :
+        decoder_(std::move(decoder)),
+        pattern_(pattern),
+        headers_only_(headers_only),
+        log_(log),
+        matched_(pattern.empty()),
+        skipping_(false)
+    {
+    }
+
+    void feed(const uint8_t* data, size_t length)
+    {
+        decoder_->feed(data, length, *this);
+    }
+
+    void part(const uint8_t* data, size_t length, int kind, bool end) override
+    {
+        if (headers_only_ && (kind == part_body))
+            length = 0;
+
+        if (matched_)
+        {
+            if (length > 0)
+                log_(data, length);
+        }
+        else if (!skipping_ && (length > 0))
+        {
+            size_t from = held_.size() - std::min(held_.size(), pattern_.size() - 1);
+            held_.append((const char*) data, length);
+            if (held_.find(pattern_, from) != std::string::npos)
+            {
+                matched_ = true;
+                log_((const uint8_t*) held_.data(), held_.size());
+                held_.clear();
+            }
+            else if (held_.size() >= max_held)
+            {
+                skipping_ = true;
+                held_.clear();
+            }
+        }
+
+        if (end)
+        {
+            held_.clear();
+            matched_ = pattern_.empty();
+            skipping_ = false;
+        }
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// timeouts for an event loop, in a hierarchical timing wheel: four levels of 64 slots with 1ms
+// ticks at the bottom, each level's slot spanning a whole turn of the level below
+// a timer lives in the lowest level whose span still reaches its expiry, and drops a level each
+// time the wheel turns over the slot holding it, so arming and cancelling are a list link or unlink,
+// and a turn only looks at the slots that came due; occupancy bitmaps find the next expiry for the
+// poll timeout without walking any lists
+// everything happens on the loop's own thread
+
+class timer_wheel;
+
+struct timer_link
+{
+    timer_link* prev;
+    timer_link* next;
+
+    timer_link() :
+        prev(this),
+        next(this)
+    {
+    }
+
+    bool empty() const
+    {
+        return next == this;
+    }
+};
+
+class timer : private timer_link
+{
+    friend class timer_wheel;
+
+    timer_wheel* wheel_; // while armed
+    uint64_t expires_; // tick
+    int level_; // where it's linked, -1 for the overflow list
+    int slot_;
+    std::function<void ()> on_expire_;
+
+    timer(const timer&) = delete;
+    void operator=(const timer&) = delete;
+
+public:
+    explicit timer(std::function<void ()> on_expire) :
+        wheel_(nullptr),
+        expires_(0),
+        level_(0),
+        slot_(0),
+        on_expire_(on_expire)
+    {
+    }
+
+    ~timer()
+    {
+        cancel();
+    }
+
+    bool armed() const
+    {
+        return wheel_ != nullptr;
+    }
+
+    // expire after the given time on wheel, rearming moves it
+    void arm(timer_wheel& wheel, std::chrono::steady_clock::duration after);
+
+    void cancel();
+};
+
+class timer_wheel
+{
+    friend class timer;
+
+    static const int levels = 4;
+    static const int slot_bits = 6;
+    static const int slots = 1 << slot_bits;
+    static const uint64_t slot_mask = slots - 1;
+
+    timer_link wheel_[levels][slots];
+    timer_link overflow_; // past the top level's span, looked at again when it turns over
+    uint64_t occupied_[levels]; // a bit per slot with timers in it
+    uint64_t current_; // the last tick that was run
+    std::chrono::steady_clock::time_point origin_;
+    size_t armed_;
+
+    timer_wheel(const timer_wheel&) = delete;
+    void operator=(const timer_wheel&) = delete;
+
+    static int first_bit(uint64_t bits)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(bits);
+#else
+        int n = 0;
+        while (!(bits & 1))
+        {
+            bits >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    uint64_t tick(std::chrono::steady_clock::time_point time) const
+    {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(time - origin_).count();
+    }
+
+    static void link(timer_link& list, timer& t)
+    {
+        t.prev = list.prev;
+        t.next = &list;
+        list.prev->next = &t;
+        list.prev = &t;
+    }
+
+    void insert(timer& t)
+    {
+        for (int level = 0; level < levels; level++)
+        {
+            int above = slot_bits * (level + 1);
+            if ((t.expires_ >> above) == (current_ >> above))
+            {
+                t.level_ = level;
+                t.slot_ = (int) ((t.expires_ >> (slot_bits * level)) & slot_mask);
+                link(wheel_[level][t.slot_], t);
+                occupied_[level] |= (uint64_t) 1 << t.slot_;
+                return;
+            }
+        }
+        t.level_ = -1;
+        link(overflow_, t);
+    }
+
+    void unlink(timer& t)
+    {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+        t.prev = t.next = &t;
+        if ((t.level_ >= 0) && wheel_[t.level_][t.slot_].empty())
+            occupied_[t.level_] &= ~((uint64_t) 1 << t.slot_);
+    }
+
+    // the slot current_ has just reached on this level, moved down to where its timers now belong,
+    // the level above first when this one has wrapped too
+    void cascade(int level)
+    {
+        uint64_t index = (current_ >> (slot_bits * level)) & slot_mask;
+        if (index == 0)
+        {
+            if (level + 1 < levels)
+                cascade(level + 1);
+            else
+                reinsert(overflow_);
+        }
+        if (occupied_[level] & ((uint64_t) 1 << index))
+        {
+            occupied_[level] &= ~((uint64_t) 1 << index);
+            reinsert(wheel_[level][index]);
+        }
+    }
+
+    void reinsert(timer_link& list)
+    {
+        timer_link moving;
+        if (list.empty())
+            return;
+        moving.next = list.next;
+        moving.prev = list.prev;
+        moving.next->prev = &moving;
+        moving.prev->next = &moving;
+        list.prev = list.next = &list;
+        while (!moving.empty())
+        {
+            timer& t = static_cast<timer&>(*moving.next);
+            moving.next = t.next;
+            t.next->prev = &moving;
+            insert(t);
+        }
+    }
+
+public:
+    timer_wheel() :
+        current_(0),
+        origin_(std::chrono::steady_clock::now()),
+        armed_(0)
+    {
+        for (auto& bits : occupied_)
+            bits = 0;
+    }
+
+    ~timer_wheel()
+    {
+        for (auto& level : wheel_)
+        {
+            for (auto& list : level)
+            {
+                while (!list.empty())
+                    static_cast<timer*>(list.next)->cancel();
+            }
+        }
+        while (!overflow_.empty())
+            static_cast<timer*>(overflow_.next)->cancel();
+    }
+
+    size_t armed() const
+    {
+        return armed_;
+    }
+
+    // ms until the loop next has something to do here, at most timeout_ms, which may be -1 for no limit
+    // a timer further up is only moved down when its slot comes round, so that is when to wake
+    int next_timeout(int timeout_ms) const
+    {
+        if (armed_ == 0)
+            return timeout_ms;
+
+        uint64_t wake = 0;
+        bool found = false;
+        for (int level = 0; (level < levels) && !found; level++)
+        {
+            int shift = slot_bits * level;
+            uint64_t index = (current_ >> shift) & slot_mask;
+            uint64_t later = (index == slot_mask) ? 0 : (occupied_[level] & (~(uint64_t) 0 << (index + 1)));
+            if (later != 0)
+            {
+                uint64_t block = (current_ >> (shift + slot_bits)) << (shift + slot_bits);
+                wake = block + ((uint64_t) first_bit(later) << shift);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            // only overflow is left, it comes down when the top level wraps
+            int top = slot_bits * levels;
+            wake = ((current_ >> top) + 1) << top;
+        }
+
+        uint64_t now = tick(std::chrono::steady_clock::now());
+        uint64_t wait = (wake > now) ? wake - now : 0;
+        if ((timeout_ms >= 0) && (wait > (uint64_t) timeout_ms))
+            return timeout_ms;
+        return (int) std::min<uint64_t>(wait, 1 << 30);
+    }
+
+    // runs every timer due by now, returns how many ran
+    size_t expire(std::chrono::steady_clock::time_point now)
+    {
+        uint64_t target = tick(now);
+        size_t ran = 0;
+        while ((current_ < target) && (armed_ > 0))
+        {
+            // nothing at the bottom, skip to where the next slot above comes down
+            if (occupied_[0] == 0)
+            {
+                uint64_t last = current_ | slot_mask;
+                if (last >= target)
+                    break;
+                current_ = last;
+            }
+
+            current_++;
+            if ((current_ & slot_mask) == 0)
+                cascade(1);
+
+            int index = (int) (current_ & slot_mask);
+            timer_link& list = wheel_[0][index];
+            while (!list.empty())
+            {
+                timer& t = static_cast<timer&>(*list.next);
+                t.cancel();
+                ran++;
+                if (t.on_expire_)
+                    t.on_expire_(); // may rearm t, or destroy it
+            }
+        }
+        if (current_ < target)
+            current_ = target;
+        return ran;
+    }
+};
+
+inline void timer::arm(timer_wheel& wheel, std::chrono::steady_clock::duration after)
+{
+    cancel();
+    auto now = std::chrono::steady_clock::now();
+    uint64_t expires = wheel.tick(now + after) + 1; // round up, a timer never fires early
+    wheel_ = &wheel;
+    expires_ = std::max(expires, wheel.current_ + 1);
+    wheel.insert(*this);
+    wheel.armed_++;
+}
+
+inline void timer::cancel()
+{
+    if (wheel_ == nullptr)
+        return;
+    wheel_->unlink(*this);
+    wheel_->armed_--;
+    wheel_ = nullptr;
+}
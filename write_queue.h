@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "pool.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#else
+#include <sys/uio.h>
+#endif
+
+// bytes waiting to go out on a socket, kept as a ring of fixed size chunks
+// appends are bulk copies into the tail chunk, and the queued chunks are
+// described as one buffer each so a single writev/sendmsg can take them all
+// chunks are borrowed from the thread's buffer pool and go back as soon as they're drained, so an
+// idle connection holds none and a busy one reuses what the last one gave back
+class write_queue
+{
+public:
+    static const size_t chunk_size = 16384;
+    static const size_t max_gather = 64;
+
+private:
+    struct chunk
+    {
+        size_t begin;
+        size_t end;
+        uint8_t data[chunk_size];
+    };
+
+    typedef buffer_pool<sizeof(chunk)> chunks;
+
+    chunk* small_ring_[4]; // enough for most connections, so they never allocate a ring
+    std::vector<chunk*> big_ring_;
+    chunk** ring_; // one or the other, the size is always a power of two
+    size_t ring_size_;
+    size_t head_;
+    size_t count_;
+    size_t size_;
+
+    write_queue(const write_queue&) = delete;
+    void operator=(const write_queue&) = delete;
+
+    chunk*& at(size_t n)
+    {
+        return ring_[(head_ + n) & (ring_size_ - 1)];
+    }
+
+    const chunk* at(size_t n) const
+    {
+        return ring_[(head_ + n) & (ring_size_ - 1)];
+    }
+
+    void push_chunk()
+    {
+        if (count_ == ring_size_)
+        {
+            std::vector<chunk*> bigger(ring_size_ * 2, nullptr);
+            for (size_t n = 0; n < count_; n++)
+                bigger[n] = at(n);
+            big_ring_.swap(bigger);
+            ring_ = big_ring_.data();
+            ring_size_ = big_ring_.size();
+            head_ = 0;
+        }
+
+        chunk* c = (chunk*) chunks::local().borrow();
+        c->begin = 0;
+        c->end = 0;
+        at(count_) = c;
+        count_++;
+    }
+
+    void pop_chunk()
+    {
+        chunk* c = at(0);
+        at(0) = nullptr;
+        head_ = (head_ + 1) & (ring_size_ - 1);
+        count_--;
+        chunks::local().give_back(c);
+    }
+
+public:
+    write_queue() :
+        ring_(small_ring_),
+        ring_size_(4),
+        head_(0),
+        count_(0),
+        size_(0)
+    {
+    }
+
+    ~write_queue()
+    {
+        clear();
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    void append(const uint8_t* data, size_t length)
+    {
+        while (length > 0)
+        {
+            if ((count_ == 0) || (at(count_ - 1)->end == chunk_size))
+                push_chunk();
+
+            chunk* tail = at(count_ - 1);
+            size_t n = std::min(length, chunk_size - tail->end);
+            memcpy(tail->data + tail->end, data, n);
+            tail->end += n;
+            size_ += n;
+            data += n;
+            length -= n;
+        }
+    }
+
+    // drop bytes from the front once the socket has taken them
+    void consume(size_t length)
+    {
+        while ((length > 0) && (count_ > 0))
+        {
+            chunk* head = at(0);
+            size_t n = std::min(length, head->end - head->begin);
+            head->begin += n;
+            size_ -= n;
+            length -= n;
+
+            if (head->begin == head->end)
+                pop_chunk();
+        }
+    }
+
+    void clear()
+    {
+        while (count_ > 0)
+            pop_chunk();
+        size_ = 0;
+    }
+
+#ifdef _WIN32
+    size_t gather(WSABUF* buffers, size_t max_buffers) const
+    {
+        size_t n = 0;
+        for (; (n < count_) && (n < max_buffers); n++)
+        {
+            const chunk* c = at(n);
+            buffers[n].buf = (char*) (c->data + c->begin);
+            buffers[n].len = (ULONG) (c->end - c->begin);
+        }
+        return n;
+    }
+#else
+    size_t gather(iovec* buffers, size_t max_buffers) const
+    {
+        size_t n = 0;
+        for (; (n < count_) && (n < max_buffers); n++)
+        {
+            const chunk* c = at(n);
+            buffers[n].iov_base = (void*) (c->data + c->begin);
+            buffers[n].iov_len = c->end - c->begin;
+        }
+        return n;
+    }
+#endif
+};